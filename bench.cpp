@@ -0,0 +1,558 @@
+//
+// bench.cpp
+//
+
+#include "bench.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cluster.h"
+#include "node.h"
+#include "mcts.h"
+#include "pool.h"
+#include "softmax.h"
+#include "search.h"
+#include "tt.h"
+#include "config.h"
+
+using namespace std;
+using namespace std::chrono;
+
+#define BenchPositions 100000
+#define BenchMaxPlies 200
+#define BenchGameMoves 2000000
+#define BenchSearchPositions 20
+#define BenchTreeNodes 100000
+#define BenchTreeBands 5
+#define BenchSearchDepth 5
+#define BenchSoftmaxSets 100000
+#define BenchForkDepth 4
+#define BenchPlayoutNodes 100000
+#define BenchClusterPositions 5
+#define BenchClusterNodes 200000
+
+// Positions from random games, played from the initial position
+vector<Position> RandomPositions(size_t num, unsigned seed, vector<color> *turns) {
+	vector<Position> positions;
+	positions.reserve(num);
+	Node *root = new Node(1);
+	Node *node = root;
+	int ply = 0;
+	while (positions.size() < num) {
+		positions.push_back(node->pos());
+		if (turns) turns->push_back(node->getColor());
+		if (node->numChildren() == 0 || ply == BenchMaxPlies) {
+			// Game over; start another one
+			delete root;
+			node = root = new Node(1);
+			ply = 0;
+			continue;
+		}
+		seed = seed * 1103515245 + 12345;
+		Node *next = node->child((seed >> 16) % node->numChildren());
+		node->deleteChildrenExcept(next);
+		next->grow(1);
+		node = next;
+		ply++;
+	}
+	delete root;
+	return positions;
+}
+
+// Moves of random games, MoveStringSize chars each, written the way a game
+// record would give them: the origin only where it is needed
+static vector<char> RandomGameMoves(size_t num, unsigned seed) {
+	vector<char> moves(num*MoveStringSize);
+	Position pos = Position::initialPosition();
+	color turn = white;
+	int ply = 0;
+	for (size_t i = 0; i < num; i++) {
+		MoveList legal;
+		pos.legalMoves(turn,&legal);
+		if (legal.size == 0 || ply == BenchMaxPlies) {
+			// Game over; start another one
+			pos = Position::initialPosition();
+			turn = white;
+			ply = 0;
+			legal.size = 0;
+			pos.legalMoves(turn,&legal);
+		}
+		seed = seed * 1103515245 + 12345;
+		PackedMove pm = legal[(seed >> 16) % legal.size];
+		Move m = pos.moveForPacked(pm);
+		if (!m.special) {
+			PackedMove match;
+			Move shorter = m;
+			shorter.rank = 0;
+			if (!m.takes || m.piecechar) {
+				shorter.file = 0;
+				if (pos.movesMatching(shorter,legal,&match) > 1) shorter.file = m.file;
+			}
+			if (pos.movesMatching(shorter,legal,&match) > 1) {
+				shorter.file = 0;
+				shorter.rank = m.rank;
+				if (pos.movesMatching(shorter,legal,&match) > 1) shorter.file = m.file;
+			}
+			m = shorter;
+		}
+		FormatMove(m,&moves[i*MoveStringSize]);
+		Position::Undo undo;
+		pos.makeMove(pm,&undo);
+		turn = OppositeColor(turn);
+		ply++;
+	}
+	return moves;
+}
+
+static double SecondsSince(steady_clock::time_point start) {
+	return duration<double>(steady_clock::now() - start).count();
+}
+
+static void BenchInCheck() {
+	vector<Position> positions = RandomPositions(BenchPositions,1);
+	const int reps = 20;
+	int checks = 0;
+	steady_clock::time_point start = steady_clock::now();
+	for (int r = 0; r < reps; r++) {
+		for (size_t i = 0; i < positions.size(); i++) {
+			checks += positions[i].inCheck(white);
+			checks += positions[i].inCheck(black);
+		}
+	}
+	double secs = SecondsSince(start);
+	double calls = 2.0 * reps * positions.size();
+	cout << "incheck: " << positions.size() << " positions, "
+		<< checks/reps << " checks, "
+		<< secs/calls*1e9 << " ns/call\n";
+}
+
+static void BenchBits() {
+	// Occupancies from real positions
+	vector<Position> positions = RandomPositions(BenchPositions,2);
+	vector<u64> masks;
+	for (size_t i = 0; i < positions.size(); i++) {
+		masks.push_back(positions[i].boardmask(white));
+		masks.push_back(positions[i].boardmask(black));
+		masks.push_back(positions[i].boardmask(white) | positions[i].boardmask(black));
+	}
+	const int reps = 50;
+	struct {
+		const char *name;
+		int (*func)(u64);
+		bool available;
+	} funcs[] = {
+		{ "popcount portable", CountBitsU64Portable, true },
+		{ "popcount hardware", CountBitsU64Hardware, CpuHasPopcnt() },
+		{ "bitscan portable ", LowestBitU64Portable, true },
+		{ "bitscan hardware ", LowestBitU64Hardware, CpuHasTzcnt() },
+	};
+	cout << "bits: " << masks.size() << " masks, CPU "
+		<< (CpuHasPopcnt() ? "has" : "lacks") << " POPCNT, "
+		<< (CpuHasTzcnt() ? "has" : "lacks") << " TZCNT\n";
+	for (size_t f = 0; f < sizeof(funcs)/sizeof(funcs[0]); f++) {
+		if (!funcs[f].available) continue;
+		long sum = 0;
+		steady_clock::time_point start = steady_clock::now();
+		for (int r = 0; r < reps; r++) {
+			for (size_t i = 0; i < masks.size(); i++) sum += funcs[f].func(masks[i]);
+		}
+		double secs = SecondsSince(start);
+		cout << "  " << funcs[f].name << ": " << secs/reps/masks.size()*1e9
+			<< " ns/call (checksum " << sum << ")\n";
+	}
+}
+
+static void BenchGrow() {
+	vector<color> turns;
+	vector<Position> positions = RandomPositions(BenchPositions,3,&turns);
+	const int reps = 5;
+	size_t children = 0;
+	steady_clock::time_point start = steady_clock::now();
+	for (int r = 0; r < reps; r++) {
+		for (size_t i = 0; i < positions.size(); i++) {
+			Node node(positions[i],turns[i],1,0);
+			children += node.numChildren();
+		}
+	}
+	double secs = SecondsSince(start);
+	cout << "grow: " << positions.size() << " positions, "
+		<< (double)children/reps/positions.size() << " children each, "
+		<< secs/reps/positions.size()*1e9 << " ns/position, "
+		<< secs/children*1e9 << " ns/child\n";
+}
+
+static void BenchPcp() {
+	vector<Position> positions = RandomPositions(BenchPositions,4);
+	const int reps = 20;
+	long sum = 0;
+	steady_clock::time_point start = steady_clock::now();
+	for (int r = 0; r < reps; r++) {
+		for (size_t i = 0; i < positions.size(); i++) {
+			int pres, cov, prot;
+			positions[i].pcp(&pres,&cov,&prot);
+			sum += pres + cov + prot;
+		}
+	}
+	double secs = SecondsSince(start);
+	cout << "pcp: " << positions.size() << " positions, "
+		<< secs/reps/positions.size()*1e9 << " ns/position (checksum " << sum << ")\n";
+}
+
+static void BenchSan() {
+	vector<char> corpus = RandomGameMoves(BenchGameMoves,5);
+	size_t num = corpus.size()/MoveStringSize;
+	vector<Move> moves(num);
+	const int reps = 5;
+	size_t bad = 0;
+	steady_clock::time_point start = steady_clock::now();
+	for (int r = 0; r < reps; r++) {
+		for (size_t i = 0; i < num; i++) {
+			bad += !ParseMove(&corpus[i*MoveStringSize],&moves[i]);
+		}
+	}
+	double parsesecs = SecondsSince(start);
+	// Formatting a parsed move gives back the text it was parsed from
+	size_t mismatched = 0;
+	char buf[MoveStringSize];
+	start = steady_clock::now();
+	for (int r = 0; r < reps; r++) {
+		for (size_t i = 0; i < num; i++) {
+			int len = FormatMove(moves[i],buf);
+			mismatched += memcmp(buf,&corpus[i*MoveStringSize],len + 1) != 0;
+		}
+	}
+	double formatsecs = SecondsSince(start);
+	cout << "san: " << num << " moves, parse " << parsesecs/reps/num*1e9 << " ns/move, format "
+		<< formatsecs/reps/num*1e9 << " ns/move (" << bad/reps << " bad, " << mismatched/reps << " mismatched)\n";
+}
+
+static void BenchSearch() {
+	vector<color> turns;
+	vector<Position> positions = RandomPositions(BenchSearchPositions,6,&turns);
+	TranspositionTable table(DefaultHashMegabytes);
+	TranspositionTable *saved = TT;
+	TT = &table;
+	size_t nodes = 0;
+	double secs = 0;
+	for (size_t i = 0; i < positions.size(); i++) {
+		table.clear();
+		AlphaBeta ab(positions[i],turns[i],0);
+		ab.search(BenchSearchDepth,SIZE_MAX);
+		nodes += ab.nodes();
+		secs += ab.seconds();
+	}
+	TT = saved;
+	cout << "search: " << positions.size() << " positions to " << BenchSearchDepth << " plies, "
+		<< nodes/positions.size() << " nodes each, " << nodes/secs << " nodes/s\n";
+}
+
+// Best-first growth from the initial position, one ply per selected leaf,
+// with the tree either evaluated and predicted in full after every batch or
+// healed after every leaf. Iterations per second, and the time the updates
+// take, are recorded for each band of tree sizes.
+static void GrowTree(bool healed, double *rates, double *updates) {
+	size_t start = nodeCount;
+	Node *root = new Node(2);
+	root->evaluate();
+	root->predict(1.0);
+	int band = 0, iterations = 0;
+	double updatesecs = 0;
+	steady_clock::time_point bandStart = steady_clock::now();
+	while (band < BenchTreeBands) {
+		steady_clock::time_point t = steady_clock::now();
+		if (!healed) {
+			root->evaluate();
+			root->predict(1.0);
+			updatesecs += SecondsSince(t);
+		}
+		Node *terms[MaxNumTerminals];
+		int numTerms = root->popFrontier(MaxNumTerminals,terms);
+		if (numTerms == 0) break;
+		for (int i = 0; i < numTerms; i++) {
+			terms[i]->grow(1);
+			if (healed) {
+				t = steady_clock::now();
+				terms[i]->heal();
+				updatesecs += SecondsSince(t);
+			}
+		}
+		iterations++;
+		if (nodeCount - start >= (size_t)(band+1)*BenchTreeNodes/BenchTreeBands) {
+			rates[band] = iterations/SecondsSince(bandStart);
+			updates[band++] = updatesecs/iterations;
+			iterations = 0;
+			updatesecs = 0;
+			bandStart = steady_clock::now();
+		}
+	}
+	delete root;
+}
+
+static void BenchHeal() {
+	double full[BenchTreeBands] = {}, healed[BenchTreeBands] = {};
+	double fullUpdates[BenchTreeBands] = {}, healedUpdates[BenchTreeBands] = {};
+	GrowTree(false,full,fullUpdates);
+	GrowTree(true,healed,healedUpdates);
+	for (int b = 0; b < BenchTreeBands; b++) {
+		cout << "heal: " << (b+1)*BenchTreeNodes/BenchTreeBands << " nodes, full "
+			<< full[b] << " iterations/s (" << fullUpdates[b]*1e6 << " us updating), healed "
+			<< healed[b] << " iterations/s (" << healedUpdates[b]*1e6 << " us updating)\n";
+	}
+}
+
+// Child values of grown positions, as the tree predicts them
+static void BenchSoftmax() {
+	vector<color> turns;
+	vector<Position> positions = RandomPositions(BenchSoftmaxSets,7,&turns);
+	const float scale = 1/PredictionSpread;
+	vector<float> args;
+	vector<int> offsets(1,0);
+	for (size_t i = 0; i < positions.size(); i++) {
+		Node node(positions[i],turns[i],1,0);
+		if (node.numChildren() == 0) continue;
+		node.evaluate();
+		for (int c = 0; c < node.numChildren(); c++) args.push_back(node.child(c)->value()*scale);
+		offsets.push_back(args.size());
+	}
+	const int reps = 20;
+	struct {
+		const char *name;
+		void (*func)(float*, int);
+		bool available;
+	} funcs[] = {
+		{ "scalar", SoftmaxScalar, true },
+		{ "SSE2  ", SoftmaxSSE2, CpuHasSSE2() },
+		{ "AVX2  ", SoftmaxAVX2, CpuHasAVX2() },
+	};
+	cout << "softmax: " << offsets.size()-1 << " sets of " << args.size() << " values, CPU "
+		<< (CpuHasSSE2() ? "has" : "lacks") << " SSE2, "
+		<< (CpuHasAVX2() ? "has" : "lacks") << " AVX2\n";
+	vector<float> expected = args;
+	for (size_t s = 0; s + 1 < offsets.size(); s++) {
+		SoftmaxScalar(&expected[offsets[s]],offsets[s+1]-offsets[s]);
+	}
+	vector<float> weights;
+	for (size_t f = 0; f < sizeof(funcs)/sizeof(funcs[0]); f++) {
+		if (!funcs[f].available) continue;
+		// Timed with copying the values in, as the tree does
+		steady_clock::time_point start = steady_clock::now();
+		for (int r = 0; r < reps; r++) {
+			weights = args;
+			for (size_t s = 0; s + 1 < offsets.size(); s++) {
+				funcs[f].func(&weights[offsets[s]],offsets[s+1]-offsets[s]);
+			}
+		}
+		double secs = SecondsSince(start);
+		// Relative error against expf of the weights, and of exp itself over
+		// the range of values: the weights of x paired with 0 are
+		// exp(x)/(exp(x)+1) and 1/(exp(x)+1), so their ratio is exp(x)
+		float err = 0;
+		for (size_t i = 0; i < args.size(); i++) {
+			err = max(err,fabsf(weights[i] - expected[i])/expected[i]);
+		}
+		float experr = 0;
+		for (int v = -WhiteMate; v <= WhiteMate; v++) {
+			float pair[2] = { v*scale, 0 };
+			funcs[f].func(pair,2);
+			float x = expf(v*scale);
+			experr = max(experr,fabsf(pair[0]/pair[1] - x)/x);
+		}
+		cout << "  " << funcs[f].name << ": " << secs/reps/args.size()*1e9
+			<< " ns/weight, max error " << err << " in weights, " << experr << " in exp\n";
+	}
+}
+
+// Checksum of the values and priorities of the tree
+static u64 TreeChecksum(Node *node) {
+	float priority = node->priority();
+	u32 bits;
+	memcpy(&bits,&priority,sizeof(bits));
+	u64 sum = (u64)(u32)node->value()*31 + bits;
+	for (int i = 0; i < node->numChildren(); i++) sum = sum*1000003 + TreeChecksum(node->child(i));
+	return sum;
+}
+
+// Evaluation and prediction of a tree grown from the initial position, split
+// between one to as many threads as there are cores, from an empty table
+static void BenchFork() {
+	size_t start = nodeCount;
+	Node root(BenchForkDepth);
+	size_t nodes = nodeCount - start;
+	TranspositionTable table(DefaultHashMegabytes);
+	TranspositionTable *saved = TT;
+	TT = &table;
+	int cores = thread::hardware_concurrency();
+	if (cores < 2) cores = 2; // To check that the results are the same
+	cout << "fork: " << nodes << " nodes, " << thread::hardware_concurrency() << " cores\n";
+	double base = 0;
+	u64 expected = 0;
+	for (int t = 1; t <= cores; t++) {
+		ThreadPool pool(t);
+		table.clear();
+		steady_clock::time_point start = steady_clock::now();
+		root.evaluate(&pool);
+		double evalsecs = SecondsSince(start);
+		start = steady_clock::now();
+		root.predict(1.0,&pool);
+		double predsecs = SecondsSince(start);
+		u64 sum = TreeChecksum(&root);
+		if (t == 1) {
+			base = evalsecs + predsecs;
+			expected = sum;
+		}
+		cout << "  " << t << " threads: evaluate " << evalsecs*1e3 << " ms, predict " << predsecs*1e3
+			<< " ms, speedup " << base/(evalsecs + predsecs) << (sum == expected ? "" : ", DIFFERENT RESULTS") << '\n';
+	}
+	TT = saved;
+}
+
+// The positions of the search benchmark searched to the same depth by one to
+// as many threads as there are cores. Speedup is in the time the main thread
+// takes to reach the depth.
+static void BenchSmp() {
+	vector<color> turns;
+	vector<Position> positions = RandomPositions(BenchSearchPositions,6,&turns);
+	TranspositionTable table(DefaultHashMegabytes);
+	TranspositionTable *saved = TT;
+	TT = &table;
+	int cores = thread::hardware_concurrency();
+	if (cores < 2) cores = 2;
+	cout << "smp: " << positions.size() << " positions to " << BenchSearchDepth << " plies, "
+		<< thread::hardware_concurrency() << " cores\n";
+	double base = 0;
+	for (int t = 1; t <= cores; t++) {
+		vector<size_t> nodes(t);
+		double secs = 0;
+		for (size_t i = 0; i < positions.size(); i++) {
+			table.clear();
+			LazySMP smp(positions[i],turns[i],0,t);
+			smp.search(BenchSearchDepth,SIZE_MAX);
+			for (int j = 0; j < t; j++) nodes[j] += smp.nodes(j);
+			secs += smp.seconds();
+		}
+		if (t == 1) base = secs;
+		cout << "  " << t << " threads: " << secs << " s, speedup " << base/secs << ", nodes/s per thread:";
+		for (int j = 0; j < t; j++) cout << ' ' << (size_t)(nodes[j]/secs);
+		cout << '\n';
+	}
+	TT = saved;
+}
+
+// Playouts from the positions of the search benchmark, each growing a tree of
+// BenchPlayoutNodes, on one to as many threads as there are cores
+static void BenchMcts() {
+	vector<color> turns;
+	vector<Position> positions = RandomPositions(BenchSearchPositions,6,&turns);
+	int cores = thread::hardware_concurrency();
+	if (cores < 2) cores = 2;
+	cout << "mcts: " << positions.size() << " positions, " << BenchPlayoutNodes << " nodes each, "
+		<< thread::hardware_concurrency() << " cores\n";
+	double base = 0;
+	for (int t = 1; t <= cores; t++) {
+		ThreadPool pool(t);
+		size_t playouts = 0;
+		double secs = 0;
+		for (size_t i = 0; i < positions.size(); i++) {
+			Node root(positions[i],turns[i],0,0);
+			MCTS mcts(&root,&pool);
+			mcts.search(BenchPlayoutNodes);
+			playouts += mcts.playouts();
+			secs += mcts.seconds();
+		}
+		if (t == 1) base = playouts/secs;
+		cout << "  " << t << " threads: " << playouts/secs << " playouts/s, speedup " << playouts/secs/base << '\n';
+	}
+}
+
+// Trees grown below each move of positions from random games, by one process
+// and then by one to as many worker processes as there are cores, forked
+// from this one and listening on ports of their own
+static void BenchCluster() {
+	vector<color> turns;
+	vector<Position> positions = RandomPositions(BenchClusterPositions,8,&turns);
+	TranspositionTable table(DefaultHashMegabytes);
+	TranspositionTable *saved = TT;
+	TT = &table;
+	int cores = thread::hardware_concurrency();
+	if (cores < 2) cores = 2;
+	cout << "cluster: " << positions.size() << " positions, " << BenchClusterNodes << " nodes each, "
+		<< thread::hardware_concurrency() << " cores" << endl;
+	vector<string> ports;
+	vector<pid_t> pids;
+	for (int w = 0; w < cores; w++) {
+		int listener = ListenForCoordinators(0);
+		ports.push_back(to_string(ListeningPort(listener)));
+		pid_t pid = fork();
+		if (pid == 0) {
+			ThreadPool pool(1);
+			ServeCoordinators(listener,&pool);
+			_exit(0);
+		}
+		close(listener);
+		pids.push_back(pid);
+	}
+	ThreadPool pool(1);
+	double base = 0;
+	vector<int> expected;
+	for (int w = 0; w <= cores; w++) {
+		Cluster cluster(vector<string>(ports.begin(),ports.begin() + w));
+		vector<int> values;
+		size_t grown = 0;
+		steady_clock::time_point start = steady_clock::now();
+		for (size_t i = 0; i < positions.size(); i++) {
+			Node root(positions[i],turns[i],0,0);
+			grown += cluster.grow(&root,BenchClusterNodes,&pool);
+			for (int c = 0; c < root.numChildren(); c++) values.push_back(root.child(c)->value());
+		}
+		double secs = SecondsSince(start);
+		if (w == 0) {
+			base = secs;
+			expected = values;
+			cout << "  1 process: ";
+		} else {
+			cout << "  " << w << " workers: ";
+		}
+		cout << grown/secs << " nodes/s, speedup " << base/secs
+			<< (values == expected ? "" : ", DIFFERENT RESULTS") << endl;
+	}
+	Cluster(ports).quit();
+	for (size_t w = 0; w < pids.size(); w++) waitpid(pids[w],0,0);
+	TT = saved;
+}
+
+struct Benchmark {
+	const char *name;
+	void (*run)();
+};
+static const Benchmark Benchmarks[] = {
+	{ "incheck", BenchInCheck },
+	{ "bits", BenchBits },
+	{ "grow", BenchGrow },
+	{ "pcp", BenchPcp },
+	{ "san", BenchSan },
+	{ "search", BenchSearch },
+	{ "smp", BenchSmp },
+	{ "mcts", BenchMcts },
+	{ "cluster", BenchCluster },
+	{ "heal", BenchHeal },
+	{ "softmax", BenchSoftmax },
+	{ "fork", BenchFork },
+};
+
+bool RunBenchmark(const char *name) {
+	bool found = false;
+	for (size_t i = 0; i < sizeof(Benchmarks)/sizeof(Benchmarks[0]); i++) {
+		if (strcmp(name,"all") == 0 || strcmp(name,Benchmarks[i].name) == 0) {
+			Benchmarks[i].run();
+			found = true;
+		}
+	}
+	return found;
+}
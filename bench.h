@@ -0,0 +1,21 @@
+//
+// bench.h
+// Benchmarks
+//
+
+#ifndef bench_h
+#define bench_h
+
+#include <vector>
+
+#include "position.h"
+
+using namespace std;
+
+// Side to move of each position is added to turns if given
+vector<Position> RandomPositions(size_t num, unsigned seed, vector<color> *turns = 0);
+// Runs the named benchmark, or all of them for "all". Returns false if there
+// is no benchmark with the given name.
+bool RunBenchmark(const char *name);
+
+#endif // bench_h
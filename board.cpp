@@ -8,66 +8,65 @@
 
 using namespace std;
 
-int CountBitsU16(u16 num) {
-	u16 mask;
-	int cnt = 0;
-	for (mask = 1; mask; mask <<= 1) {
-		if (num & mask) cnt++;
-	}
-	return cnt;
+//
+// bit counting and scanning
+//
+#if defined(__x86_64__) || defined(__i386__)
+#define HardwareBits __attribute__((target("popcnt,bmi")))
+#else
+#define HardwareBits
+#endif
+int (*CountBitsU64)(u64) = CountBitsU64Portable;
+int (*LowestBitU64)(u64) = LowestBitU64Portable;
+
+int CountBitsU64Portable(u64 num) {
+	// Sum bits in parallel: pairs, nibbles, then bytes
+	num = num - ((num >> 1) & 0x5555555555555555ULL);
+	num = (num & 0x3333333333333333ULL) + ((num >> 2) & 0x3333333333333333ULL);
+	num = (num + (num >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (num * 0x0101010101010101ULL) >> 56;
 }
-int CountBitsU64(u64 num) {
-	u64 mask;
-	int cnt = 0;
-	for (mask = 1; mask; mask <<= 1) {
-		if (num & mask) cnt++;
-	}
-	return cnt;
+HardwareBits int CountBitsU64Hardware(u64 num) {
+	return __builtin_popcountll(num);
+}
+int LowestBitU64Portable(u64 num) {
+	// De Bruijn multiplication of the isolated lowest bit
+	static const int index[64] = {
+		0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+		62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+		63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+		46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6
+	};
+	if (num == 0) return 64;
+	return index[((num & -num) * 0x03f79d71b4cb0a89ULL) >> 58];
+}
+HardwareBits int LowestBitU64Hardware(u64 num) {
+	return num ? __builtin_ctzll(num) : 64;
+}
+bool CpuHasPopcnt() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_cpu_supports("popcnt");
+#else
+	return true; // Left to the compiler
+#endif
+}
+bool CpuHasTzcnt() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_cpu_supports("bmi");
+#else
+	return true; // Left to the compiler
+#endif
 }
 
 square SquareWithFileAndRankChars(char file, char rank) {
 	return 'h' - file + (rank - '1') * 8;
 }
-u8 FileIdxForSquare(square s) { return s % 8; }
-u8 RankIdxForSquare(square s) { return s / 8; }
 char FileCharForSquare(square s) {
 	return 'h' - FileIdxForSquare(s);
 }
 char RankCharForSquare(square s) {
 	return '1' + RankIdxForSquare(s);
 }
-bool HasSquareAbove(square s) { return s < sq_h8; }
-square SquareAbove(square s) { return s + 8; }
-bool HasSquareBelow(square s) { return s > sq_a1; }
-square SquareBelow(square s) { return s - 8; }
-bool HasSquareRight(square s) { return (s % 8) > 0; }
-square SquareRight(square s) { return s - 1; }
-bool HasSquareLeft(square s) { return (s % 8) < 7; }
-square SquareLeft(square s) { return s + 1; }
-bool HasSquareAboveRight(square s) { return s < sq_h8 && (s % 8) > 0; }
-square SquareAboveRight(square s) { return s + 7; }
-bool HasSquareAboveLeft(square s) { return s < sq_h8 && (s % 8) < 7; }
-square SquareAboveLeft(square s) { return s + 9; }
-bool HasSquareBelowRight(square s) { return s > sq_a1 && (s % 8) > 0; }
-square SquareBelowRight(square s) { return s - 9; }
-bool HasSquareBelowLeft(square s) { return s > sq_a1 && (s % 8) < 7; }
-square SquareBelowLeft(square s) { return s - 7; }
-bool HasSquareUUR(square s) { return s < sq_h7 && (s % 8) > 0; }
-square SquareUUR(square s) { return s + 15; }
-bool HasSquareUUL(square s) { return s < sq_a6 && (s % 8) < 7; }
-square SquareUUL(square s) { return s + 17; }
-bool HasSquareRRU(square s) { return (s % 8) > 1 && s < sq_h8; }
-square SquareRRU(square s) { return s + 6; }
-bool HasSquareRRD(square s) { return (s % 8) > 1 && s > sq_a1; }
-square SquareRRD(square s) { return s - 10; }
-bool HasSquareLLU(square s) { return (s % 8) < 6 && s < sq_h8; }
-square SquareLLU(square s) { return s + 10; }
-bool HasSquareLLD(square s) { return (s % 8) < 6 && s > sq_a1; }
-square SquareLLD(square s) { return s - 6; }
-bool HasSquareDDR(square s) { return s > sq_h3 && (s % 8) > 0; }
-square SquareDDR(square s) { return s - 17; }
-bool HasSquareDDL(square s) { return s > sq_a2 && (s % 8) < 7; }
-square SquareDDL(square s) { return s - 15; }
 #define MIN(a,b) (a < b ? a : b)
 #define MAX(a,b) (a > b ? a : b)
 int StepsToCorner(square s) {
@@ -76,9 +75,155 @@ int StepsToCorner(square s) {
 	return MAX(MIN(7 - ri, ri), MIN(7 - fi, fi));
 }
 
-color OppositeColor(color c) {
-	return 1^c;
+//
+// sliding attacks
+//
+Magic RookMagics[64];
+Magic BishopMagics[64];
+static u64 RookTable[0x19000];
+static u64 BishopTable[0x1480];
+
+static const int RookDirs[4] = { DirAbove, DirBelow, DirRight, DirLeft };
+static const int BishopDirs[4] = { DirAboveRight, DirAboveLeft, DirBelowRight, DirBelowLeft };
+// Walks each ray one square at a time, stopping at the first occupied square.
+// This is the reference the magic tables are built from.
+static u64 SlidingAttacks(const int *dirs, square s, u64 occ) {
+	u64 att = 0;
+	for (int i = 0; i < 4; i++) {
+		for (square cs = Neighbors[dirs[i]][s]; cs != nosquare; cs = Neighbors[dirs[i]][cs]) {
+			att |= (u64)1 << cs;
+			if (occ & ((u64)1 << cs)) break;
+		}
+	}
+	return att;
+}
+// Relevant occupancy: the ray squares whose contents can block the slider.
+// The last square of each ray never blocks anything beyond it.
+static u64 SlidingMask(const int *dirs, square s) {
+	u64 mask = 0;
+	for (int i = 0; i < 4; i++) {
+		for (square cs = Neighbors[dirs[i]][s]; cs != nosquare; cs = Neighbors[dirs[i]][cs]) {
+			if (Neighbors[dirs[i]][cs] == nosquare) break;
+			mask |= (u64)1 << cs;
+		}
+	}
+	return mask;
 }
+// Multipliers mapping each relevant occupancy to a slot of the attack table.
+// They were found by a seeded random search over sparse 64-bit numbers.
+static const u64 RookMagicNumbers[64] = {
+	0x1080004008801020ULL, 0x0840092002c03000ULL, 0x1900200010400900ULL, 0x0880100008000480ULL,
+	0x4200100420080200ULL, 0x8100020100080400ULL, 0x0200040110886200ULL, 0x0200008040220411ULL,
+	0x0404800084400220ULL, 0x0000401000402000ULL, 0x0086001081220440ULL, 0x0408800800100280ULL,
+	0x000a001201040820ULL, 0x8848800200840080ULL, 0x4001000100040200ULL, 0x0442000102105084ULL,
+	0x9080010020804100ULL, 0x0040404000201009ULL, 0x0000808010002009ULL, 0x2200090021d00100ULL,
+	0x0008008008040080ULL, 0x0004004002010040ULL, 0x0011040008015042ULL, 0x00000a0001768104ULL,
+	0x0000800080204009ULL, 0x2010004140002001ULL, 0x9800200280100080ULL, 0x1000100080080080ULL,
+	0x0442000a00049020ULL, 0x2100040080020080ULL, 0x0800120400900148ULL, 0x0010040a00128541ULL,
+	0x2800804000800030ULL, 0x1010002000400041ULL, 0x4000200011004100ULL, 0x0610008410800800ULL,
+	0x0400802402800800ULL, 0xc100020080800400ULL, 0x0002000802000401ULL, 0x0182085882000401ULL,
+	0x0220204000808000ULL, 0x2860100040024022ULL, 0x0001002004110040ULL, 0x99101042000a0020ULL,
+	0x0004080004008080ULL, 0x0010040002008080ULL, 0x2012004881020004ULL, 0x8300842444820011ULL,
+	0x0088403882010200ULL, 0x0820400080210100ULL, 0x0110910040a00300ULL, 0x0801100280080480ULL,
+	0x0242009008200600ULL, 0x1002000489500200ULL, 0x0040800200010080ULL, 0x0091800041000080ULL,
+	0x0000209300488001ULL, 0x04c1002414824001ULL, 0x020020000b001041ULL, 0x7000100004200901ULL,
+	0x8002002004100802ULL, 0x30010002084c0007ULL, 0x0888221800813004ULL, 0x4000002840840112ULL,
+};
+static const u64 BishopMagicNumbers[64] = {
+	0x10102002004a1420ULL, 0x8020040400584008ULL, 0x10510800811201c8ULL, 0x5204042080000088ULL,
+	0x2204106880000002ULL, 0x1401042004000000ULL, 0x0400880410042004ULL, 0x0028208200a02020ULL,
+	0x1500241990010e00ULL, 0x8001200182020a40ULL, 0x40004101030b0000ULL, 0x8002041042000100ULL,
+	0x4010011041020038ULL, 0x0000010421044000ULL, 0x1500210808020a00ULL, 0x8000088400880520ULL,
+	0x0405004010040100ULL, 0x1005823210040108ULL, 0x2708008102040011ULL, 0x4048200404009100ULL,
+	0x0018104101400024ULL, 0x0003000601190101ULL, 0x8004803108491000ULL, 0x8014241200820800ULL,
+	0x0006e080100c3040ULL, 0x0501044a11041800ULL, 0x9020300008004045ULL, 0x0894080000220040ULL,
+	0x1001010083104000ULL, 0x5004030040900080ULL, 0x000400422c012400ULL, 0x0002128698404812ULL,
+	0x1010108404900440ULL, 0x0928021182084100ULL, 0x2006080409020024ULL, 0x1010202020180080ULL,
+	0xa010008200202200ULL, 0x2098015100019004ULL, 0x0002041440810811ULL, 0x802a02020000b098ULL,
+	0x0009015090004060ULL, 0x4000821082081001ULL, 0x0100210040420800ULL, 0x0800004010488a00ULL,
+	0x2000081104004040ULL, 0x4c8e029015000082ULL, 0x0420340322224842ULL, 0x1298260043400210ULL,
+	0x0000822802400008ULL, 0x00008a0101600000ULL, 0x3040003412080021ULL, 0x3040290220884800ULL,
+	0x4a1500401041004aULL, 0x8010200282020781ULL, 0x0020203142209091ULL, 0x0070300600902110ULL,
+	0x0040808800b62048ULL, 0x0000810400c44420ULL, 0x00080400440c0441ULL, 0x8340080020840411ULL,
+	0x0000000104208200ULL, 0x0000800810d00080ULL, 0x0400530411080200ULL, 0x4040702400932244ULL,
+};
+static void InitMagics(Magic *magics, const u64 *numbers, u64 *table, const int *dirs) {
+	u64 *attacks = table;
+	for (square s = 0; s < 64; s++) {
+		Magic &m = magics[s];
+		m.mask = SlidingMask(dirs,s);
+		m.magic = numbers[s];
+		m.shift = 64 - CountBitsU64(m.mask);
+		m.attacks = attacks;
+		u64 size = (u64)1 << (64 - m.shift);
+		for (u64 i = 0; i < size; i++) attacks[i] = 0;
+		// Enumerate all subsets of the mask (Carry-Rippler) and check that
+		// subsets sharing a slot also share their attack set
+		u64 occ = 0;
+		do {
+			u64 att = SlidingAttacks(dirs,s,occ);
+			u64 &slot = attacks[m.index(occ)];
+			if (slot && slot != att) throw runtime_error("bad magic number");
+			slot = att;
+			occ = (occ - m.mask) & m.mask;
+		} while (occ);
+		attacks += size;
+	}
+}
+//
+// line tables
+//
+u64 BetweenMasks[64][64];
+u64 LineMasks[64][64];
+
+static void InitLines() {
+	for (square s = 0; s < 64; s++) {
+		for (square t = 0; t < 64; t++) BetweenMasks[s][t] = LineMasks[s][t] = 0;
+		for (int d = 0; d < 8; d++) {
+			int od = (d + 4) % 8; // Opposite direction
+			u64 ray = Rays[d][s];
+			while (ray) {
+				square t = LowestBitU64(ray);
+				ray &= ray - 1;
+				BetweenMasks[s][t] = Rays[d][s] & Rays[od][t];
+				LineMasks[s][t] = Rays[d][s] | Rays[od][s] | (u64)1 << s;
+			}
+		}
+	}
+}
+//
+// Zobrist keys
+//
+u64 ZobristPieces[2*NumKinds][64];
+u64 ZobristCastling[16];
+u64 ZobristBlackToMove;
+
+static void InitZobrist() {
+	// xorshift64* with a fixed seed, so keys are the same from run to run
+	u64 x = 0x2545f4914f6cdd1dull;
+	auto next = [&x]() {
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		return x * 0x2545f4914f6cdd1dull;
+	};
+	for (int k = 0; k < 2*NumKinds; k++) {
+		for (square s = 0; s < 64; s++) ZobristPieces[k][s] = next();
+	}
+	// No rights lost leaves the key unchanged
+	ZobristCastling[0] = 0;
+	for (int i = 1; i < 16; i++) ZobristCastling[i] = next();
+	ZobristBlackToMove = next();
+}
+void InitBoard() {
+	if (CpuHasPopcnt()) CountBitsU64 = CountBitsU64Hardware;
+	if (CpuHasTzcnt()) LowestBitU64 = LowestBitU64Hardware;
+	InitMagics(RookMagics,RookMagicNumbers,RookTable,RookDirs);
+	InitMagics(BishopMagics,BishopMagicNumbers,BishopTable,BishopDirs);
+	InitLines();
+	InitZobrist();
+}
+
 
 bool IsPieceChar(char c) {
 	return c == pawn || c == rook || c == knight || c == bishop || c == queen || c == king;
@@ -18,8 +18,23 @@ typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
-int CountBitsU16(u16);
-int CountBitsU64(u64);
+
+//
+// bit counting and scanning
+//
+// Each comes in a portable version and one built on the POPCNT and TZCNT
+// instructions. InitBoard points CountBitsU64 and LowestBitU64 at the
+// hardware versions if the CPU supports them.
+//
+extern int (*CountBitsU64)(u64);
+extern int (*LowestBitU64)(u64); // 64 if no bit is set
+inline int CountBitsU16(u16 num) { return CountBitsU64(num); }
+int CountBitsU64Portable(u64);
+int CountBitsU64Hardware(u64);
+int LowestBitU64Portable(u64);
+int LowestBitU64Hardware(u64);
+bool CpuHasPopcnt();
+bool CpuHasTzcnt();
 
 //
 // node termination status
@@ -54,6 +69,8 @@ typedef u8 square;
 #define sq_c8 61
 #define sq_d1 4
 #define sq_d8 60
+#define sq_e1 3
+#define sq_e8 59
 #define sq_f1 2
 #define sq_f8 58
 #define sq_g1 1
@@ -67,44 +84,212 @@ typedef u8 square;
 #define PromotionMask 0x40
 #define nosquare 64
 square SquareWithFileAndRankChars(char file, char rank);
-u8 FileIdxForSquare(square);
-u8 RankIdxForSquare(square);
+constexpr u8 FileIdxForSquare(square s) { return s % 8; } // 0 is the h-file
+constexpr u8 RankIdxForSquare(square s) { return s / 8; }
 char FileCharForSquare(square);
 char RankCharForSquare(square);
-bool HasSquareAbove(square);
-square SquareAbove(square);
-bool HasSquareBelow(square);
-square SquareBelow(square);
-bool HasSquareRight(square);
-square SquareRight(square);
-bool HasSquareLeft(square);
-square SquareLeft(square);
-bool HasSquareAboveRight(square);
-square SquareAboveRight(square);
-bool HasSquareAboveLeft(square);
-square SquareAboveLeft(square);
-bool HasSquareBelowRight(square);
-square SquareBelowRight(square);
-bool HasSquareBelowLeft(square);
-square SquareBelowLeft(square);
-bool HasSquareUUR(square);
-square SquareUUR(square);
-bool HasSquareUUL(square);
-square SquareUUL(square);
-bool HasSquareRRU(square);
-square SquareRRU(square);
-bool HasSquareRRD(square);
-square SquareRRD(square);
-bool HasSquareLLU(square);
-square SquareLLU(square);
-bool HasSquareLLD(square);
-square SquareLLD(square);
-bool HasSquareDDR(square);
-square SquareDDR(square);
-bool HasSquareDDL(square);
-square SquareDDL(square);
+constexpr bool HasSquareAbove(square s) { return s < sq_h8; }
+constexpr square SquareAbove(square s) { return s + 8; }
+constexpr bool HasSquareBelow(square s) { return s > sq_a1; }
+constexpr square SquareBelow(square s) { return s - 8; }
+constexpr bool HasSquareRight(square s) { return (s % 8) > 0; }
+constexpr square SquareRight(square s) { return s - 1; }
+constexpr bool HasSquareLeft(square s) { return (s % 8) < 7; }
+constexpr square SquareLeft(square s) { return s + 1; }
+constexpr bool HasSquareAboveRight(square s) { return s < sq_h8 && (s % 8) > 0; }
+constexpr square SquareAboveRight(square s) { return s + 7; }
+constexpr bool HasSquareAboveLeft(square s) { return s < sq_h8 && (s % 8) < 7; }
+constexpr square SquareAboveLeft(square s) { return s + 9; }
+constexpr bool HasSquareBelowRight(square s) { return s > sq_a1 && (s % 8) > 0; }
+constexpr square SquareBelowRight(square s) { return s - 9; }
+constexpr bool HasSquareBelowLeft(square s) { return s > sq_a1 && (s % 8) < 7; }
+constexpr square SquareBelowLeft(square s) { return s - 7; }
+constexpr bool HasSquareUUR(square s) { return s < sq_h7 && (s % 8) > 0; }
+constexpr square SquareUUR(square s) { return s + 15; }
+constexpr bool HasSquareUUL(square s) { return s < sq_a6 && (s % 8) < 7; }
+constexpr square SquareUUL(square s) { return s + 17; }
+constexpr bool HasSquareRRU(square s) { return (s % 8) > 1 && s < sq_h8; }
+constexpr square SquareRRU(square s) { return s + 6; }
+constexpr bool HasSquareRRD(square s) { return (s % 8) > 1 && s > sq_a1; }
+constexpr square SquareRRD(square s) { return s - 10; }
+constexpr bool HasSquareLLU(square s) { return (s % 8) < 6 && s < sq_h8; }
+constexpr square SquareLLU(square s) { return s + 10; }
+constexpr bool HasSquareLLD(square s) { return (s % 8) < 6 && s > sq_a1; }
+constexpr square SquareLLD(square s) { return s - 6; }
+constexpr bool HasSquareDDR(square s) { return s > sq_h3 && (s % 8) > 0; }
+constexpr square SquareDDR(square s) { return s - 17; }
+constexpr bool HasSquareDDL(square s) { return s > sq_a2 && (s % 8) < 7; }
+constexpr square SquareDDL(square s) { return s - 15; }
 int StepsToCorner(square);
 
+//
+// geometry tables
+//
+// Generated at compile time from the square functions above. Neighbors gives
+// the square one step away in a direction, or nosquare off the board; Rays
+// gives every square from (not including) a square to the board edge.
+//
+#define DirAbove 0
+#define DirAboveRight 1
+#define DirRight 2
+#define DirBelowRight 3
+#define DirBelow 4
+#define DirBelowLeft 5
+#define DirLeft 6
+#define DirAboveLeft 7
+#define DirUUR 8 // Knight jumps
+#define DirUUL 9
+#define DirRRU 10
+#define DirRRD 11
+#define DirLLU 12
+#define DirLLD 13
+#define DirDDR 14
+#define DirDDL 15
+constexpr square NeighborOf(int dir, square s) {
+	switch (dir) {
+	case DirAbove: return HasSquareAbove(s) ? SquareAbove(s) : nosquare;
+	case DirAboveRight: return HasSquareAboveRight(s) ? SquareAboveRight(s) : nosquare;
+	case DirRight: return HasSquareRight(s) ? SquareRight(s) : nosquare;
+	case DirBelowRight: return HasSquareBelowRight(s) ? SquareBelowRight(s) : nosquare;
+	case DirBelow: return HasSquareBelow(s) ? SquareBelow(s) : nosquare;
+	case DirBelowLeft: return HasSquareBelowLeft(s) ? SquareBelowLeft(s) : nosquare;
+	case DirLeft: return HasSquareLeft(s) ? SquareLeft(s) : nosquare;
+	case DirAboveLeft: return HasSquareAboveLeft(s) ? SquareAboveLeft(s) : nosquare;
+	case DirUUR: return HasSquareUUR(s) ? SquareUUR(s) : nosquare;
+	case DirUUL: return HasSquareUUL(s) ? SquareUUL(s) : nosquare;
+	case DirRRU: return HasSquareRRU(s) ? SquareRRU(s) : nosquare;
+	case DirRRD: return HasSquareRRD(s) ? SquareRRD(s) : nosquare;
+	case DirLLU: return HasSquareLLU(s) ? SquareLLU(s) : nosquare;
+	case DirLLD: return HasSquareLLD(s) ? SquareLLD(s) : nosquare;
+	case DirDDR: return HasSquareDDR(s) ? SquareDDR(s) : nosquare;
+	default: return HasSquareDDL(s) ? SquareDDL(s) : nosquare;
+	}
+}
+struct NeighborTable {
+	square squares[16][64];
+	constexpr const square* operator[](int dir) const { return squares[dir]; }
+};
+struct BitboardTable {
+	u64 masks[64];
+	constexpr const u64& operator[](square s) const { return masks[s]; }
+};
+struct BitboardTables {
+	BitboardTable tables[8];
+	constexpr const BitboardTable& operator[](int i) const { return tables[i]; }
+};
+constexpr NeighborTable MakeNeighbors() {
+	NeighborTable t = {};
+	for (int d = 0; d < 16; d++) {
+		for (int s = 0; s < 64; s++) t.squares[d][s] = NeighborOf(d,s);
+	}
+	return t;
+}
+constexpr NeighborTable Neighbors = MakeNeighbors();
+constexpr BitboardTables MakeRays() {
+	BitboardTables t = {};
+	for (int d = 0; d < 8; d++) {
+		for (int s = 0; s < 64; s++) {
+			for (square cs = Neighbors[d][s]; cs != nosquare; cs = Neighbors[d][cs]) {
+				t.tables[d].masks[s] |= (u64)1 << cs;
+			}
+		}
+	}
+	return t;
+}
+constexpr BitboardTables Rays = MakeRays();
+// Union of the one-step neighbors in directions first to last
+constexpr BitboardTable MakeStepAttacks(int first, int last) {
+	BitboardTable t = {};
+	for (int s = 0; s < 64; s++) {
+		for (int d = first; d <= last; d++) {
+			if (Neighbors[d][s] != nosquare) t.masks[s] |= (u64)1 << Neighbors[d][s];
+		}
+	}
+	return t;
+}
+constexpr BitboardTable KnightAttacks = MakeStepAttacks(DirUUR,DirDDL);
+constexpr BitboardTable KingAttacks = MakeStepAttacks(DirAbove,DirAboveLeft);
+constexpr BitboardTables MakePawnAttacks() {
+	BitboardTables t = {};
+	for (int s = 0; s < 64; s++) {
+		if (Neighbors[DirAboveRight][s] != nosquare) t.tables[0].masks[s] |= (u64)1 << Neighbors[DirAboveRight][s];
+		if (Neighbors[DirAboveLeft][s] != nosquare) t.tables[0].masks[s] |= (u64)1 << Neighbors[DirAboveLeft][s];
+		if (Neighbors[DirBelowRight][s] != nosquare) t.tables[1].masks[s] |= (u64)1 << Neighbors[DirBelowRight][s];
+		if (Neighbors[DirBelowLeft][s] != nosquare) t.tables[1].masks[s] |= (u64)1 << Neighbors[DirBelowLeft][s];
+	}
+	return t;
+}
+constexpr BitboardTables PawnAttacks = MakePawnAttacks(); // Squares a pawn of the given color attacks
+
+//
+// sliding attacks
+//
+// Magic bitboard tables giving the squares attacked by a rook or bishop on a
+// given square for a given board occupancy. InitBoard must be called before
+// any of the lookups below.
+//
+struct Magic {
+	u64 mask; // Relevant occupancy, excluding the board edges
+	u64 magic;
+	u64 *attacks;
+	int shift;
+	unsigned index(u64 occ) const { return ((occ & mask) * magic) >> shift; }
+};
+extern Magic RookMagics[64];
+extern Magic BishopMagics[64];
+void InitBoard();
+inline u64 RookAttacks(square s, u64 occ) {
+	return RookMagics[s].attacks[RookMagics[s].index(occ)];
+}
+inline u64 BishopAttacks(square s, u64 occ) {
+	return BishopMagics[s].attacks[BishopMagics[s].index(occ)];
+}
+inline u64 QueenAttacks(square s, u64 occ) {
+	return RookAttacks(s,occ) | BishopAttacks(s,occ);
+}
+
+//
+// line tables
+//
+// Also filled by InitBoard.
+//
+extern u64 BetweenMasks[64][64]; // Squares strictly between two aligned squares
+extern u64 LineMasks[64][64]; // Whole line through two aligned squares, 0 if not aligned
+
+//
+// piece kind
+//
+// Index of each kind of piece in per-kind tables, such as the piece bitboards
+// of Position. Promoted pawns count as the piece they were promoted to.
+//
+#define KindPawn 0
+#define KindRook 1
+#define KindKnight 2
+#define KindBishop 3
+#define KindQueen 4
+#define KindKing 5
+#define NumKinds 6
+inline int KindForPieceChar(char pc) {
+	switch (pc) {
+	case 'p': return KindPawn;
+	case 'R': return KindRook;
+	case 'N': return KindKnight;
+	case 'B': return KindBishop;
+	case 'Q': return KindQueen;
+	default: return KindKing;
+	}
+}
+
+//
+// Zobrist keys
+//
+// Random keys XORed together to identify a position, also filled by
+// InitBoard. Pieces are indexed by kind, plus NumKinds for black.
+//
+extern u64 ZobristPieces[2*NumKinds][64];
+extern u64 ZobristCastling[16]; // Indexed by the lost castling rights
+extern u64 ZobristBlackToMove;
+
 //
 // color
 //
@@ -112,7 +297,7 @@ typedef u8 color;
 #define white 0
 #define black 1
 #define emptycolor 2
-color OppositeColor(color);
+constexpr color OppositeColor(color c) { return c == white ? black : white; }
 
 //
 // piece
@@ -0,0 +1,224 @@
+//
+// cluster.cpp
+//
+
+#include "cluster.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "tt.h"
+
+using namespace std;
+
+static void SendLine(int socket, const string &line) {
+	string s = line + '\n';
+	size_t sent = 0;
+	while (sent < s.size()) {
+		ssize_t n = send(socket,s.data() + sent,s.size() - sent,MSG_NOSIGNAL);
+		if (n <= 0) throw runtime_error("lost connection");
+		sent += n;
+	}
+}
+// Returns false if the other end closed the connection between lines
+static bool ReceiveLine(int socket, string *line) {
+	line->clear();
+	char c;
+	while (1) {
+		ssize_t n = recv(socket,&c,1,0);
+		if (n == 0 && line->empty()) return false;
+		if (n <= 0) throw runtime_error("lost connection");
+		if (c == '\n') return true;
+		*line += c;
+	}
+}
+
+int GrowSubtree(const string &fen, size_t nodes, ThreadPool *pool, size_t *grown) {
+	color turn;
+	int halfmoves;
+	Position pos = Position::fromFEN(fen,&turn,&halfmoves);
+	if (TT) TT->clear();
+	size_t start = nodeCount;
+	Node root(pos,turn,1,halfmoves);
+	int value = root.growBestFirst(start + nodes,pool);
+	*grown = nodeCount - start;
+	return value;
+}
+
+//
+// worker
+//
+int ListenForCoordinators(int port, const string &address) {
+	sockaddr_in addr;
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET;
+	if (inet_pton(AF_INET,address.c_str(),&addr.sin_addr) != 1) throw runtime_error("bad worker address");
+	addr.sin_port = htons(port);
+	int s = socket(AF_INET,SOCK_STREAM,0);
+	if (s < 0) throw runtime_error("cannot create socket");
+	int on = 1;
+	setsockopt(s,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+	if (bind(s,(sockaddr*)&addr,sizeof(addr)) < 0 || listen(s,1) < 0) {
+		close(s);
+		throw runtime_error("cannot listen for coordinators");
+	}
+	return s;
+}
+int ListeningPort(int socket) {
+	sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	if (getsockname(socket,(sockaddr*)&addr,&len) < 0) throw runtime_error("cannot get port");
+	return ntohs(addr.sin_port);
+}
+void ServeCoordinators(int socket, ThreadPool *pool) {
+	bool quit = false;
+	while (!quit) {
+		int conn = accept(socket,0,0);
+		if (conn < 0) throw runtime_error("cannot accept coordinator");
+		// A coordinator that goes away or sends something else is dropped, and
+		// the next one waited for
+		try {
+			string line;
+			while (ReceiveLine(conn,&line)) {
+				stringstream ss(line);
+				string cmd, fen;
+				size_t nodes;
+				ss >> cmd;
+				if (cmd == "quit") {
+					quit = true;
+					break;
+				}
+				if (cmd != "grow" || !(ss >> nodes) || !getline(ss >> ws,fen) || nodes > MaxSubtreeNodes) {
+					throw runtime_error("bad request");
+				}
+				size_t grown;
+				int value = GrowSubtree(fen,nodes,pool,&grown);
+				stringstream reply;
+				reply << value << ' ' << grown;
+				SendLine(conn,reply.str());
+			}
+		} catch (runtime_error &e) { }
+		close(conn);
+	}
+	close(socket);
+}
+
+//
+// Cluster
+//
+static int ConnectToWorker(const string &worker) {
+	size_t colon = worker.rfind(':');
+	string host = colon == string::npos ? "localhost" : worker.substr(0,colon);
+	string port = colon == string::npos ? worker : worker.substr(colon+1);
+	addrinfo hints, *addrs;
+	memset(&hints,0,sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(),port.c_str(),&hints,&addrs) != 0) {
+		throw runtime_error("cannot find worker " + worker);
+	}
+	int s = -1;
+	for (addrinfo *a = addrs; a && s < 0; a = a->ai_next) {
+		s = socket(a->ai_family,a->ai_socktype,a->ai_protocol);
+		if (s >= 0 && connect(s,a->ai_addr,a->ai_addrlen) < 0) {
+			close(s);
+			s = -1;
+		}
+	}
+	freeaddrinfo(addrs);
+	if (s < 0) throw runtime_error("cannot connect to worker " + worker);
+	return s;
+}
+Cluster::Cluster(const vector<string> &workers) {
+	for (size_t i = 0; i < workers.size(); i++) _sockets.push_back(ConnectToWorker(workers[i]));
+}
+Cluster::~Cluster() {
+	for (size_t i = 0; i < _sockets.size(); i++) close(_sockets[i]);
+}
+size_t Cluster::grow(Node *node, size_t maxnodes, ThreadPool *pool) {
+	node->grow(1);
+	int num = node->_children.size();
+	if (num == 0) return 0;
+	// Shares by the children's own values, which unlike the table's do not
+	// depend on what was searched before
+	for (int i = 0; i < num; i++) node->_children[i]->_value = node->_children[i]->intrinsicValue();
+	node->predictChildren();
+	vector<string> fens(num);
+	vector<size_t> nodes(num);
+	vector<int> order(num);
+	for (int i = 0; i < num; i++) {
+		Node *child = node->_children[i];
+		fens[i] = child->_pos.toFEN(child->_color,child->movesWithoutPawnMove());
+		nodes[i] = min((size_t)(child->_share*maxnodes),(size_t)MaxSubtreeNodes);
+		order[i] = i;
+	}
+	stable_sort(order.begin(),order.end(),[&](int a, int b) { return nodes[a] > nodes[b]; });
+	// Each worker has a thread here taking the largest subtree left
+	vector<int> values(num);
+	vector<size_t> grown(num);
+	atomic<int> next(0);
+	auto work = [&](int w) {
+		for (int k = next++; k < num; k = next++) {
+			int i = order[k];
+			if (w < 0) {
+				values[i] = GrowSubtree(fens[i],nodes[i],pool,&grown[i]);
+				continue;
+			}
+			stringstream request;
+			request << "grow " << nodes[i] << ' ' << fens[i];
+			SendLine(_sockets[w],request.str());
+			string reply;
+			if (!ReceiveLine(_sockets[w],&reply)) throw runtime_error("lost connection to worker");
+			stringstream ss(reply);
+			if (!(ss >> values[i] >> grown[i])) throw runtime_error("bad reply from worker");
+		}
+	};
+	if (_sockets.empty()) {
+		work(-1);
+	} else {
+		vector<thread> threads;
+		vector<exception_ptr> errors(_sockets.size());
+		for (size_t w = 0; w < _sockets.size(); w++) {
+			threads.push_back(thread([&,w]() {
+				try {
+					work(w);
+				} catch (...) {
+					errors[w] = current_exception();
+				}
+			}));
+		}
+		for (size_t w = 0; w < threads.size(); w++) threads[w].join();
+		for (size_t w = 0; w < errors.size(); w++) {
+			if (errors[w]) rethrow_exception(errors[w]);
+		}
+	}
+	size_t total = 0;
+	for (int i = 0; i < num; i++) {
+		node->_children[i]->_value = values[i];
+		if (i == 0 || (node->_color == white ? values[i] > node->_value : values[i] < node->_value)) {
+			node->_value = values[i];
+		}
+		total += grown[i];
+	}
+	return total;
+}
+int Cluster::workers() const { return _sockets.size(); }
+void Cluster::quit() {
+	for (size_t i = 0; i < _sockets.size(); i++) {
+		try {
+			SendLine(_sockets[i],"quit");
+		} catch (runtime_error &e) { }
+	}
+}
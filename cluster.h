@@ -0,0 +1,60 @@
+//
+// cluster.h
+// Search across processes
+//
+
+#ifndef cluster_h
+#define cluster_h
+
+#include <string>
+#include <vector>
+
+#include "node.h"
+#include "pool.h"
+
+using namespace std;
+
+// Grows a tree from the position best-first until nodes more nodes have been
+// grown, from an empty transposition table so that the result does not
+// depend on what was grown before. Returns the value of the tree, and sets
+// grown to the number of nodes grown.
+int GrowSubtree(const string &fen, size_t nodes, ThreadPool*, size_t *grown);
+
+//
+// worker
+//
+// Workers grow subtrees for coordinators connecting over TCP, one at a time.
+// Each request is a line "grow NODES FEN", answered with a line
+// "VALUE GROWN". A line "quit" stops the worker. A coordinator asking for
+// more than MaxSubtreeNodes nodes, or for an illegal position, is dropped.
+// Workers listen on the loopback address unless given another, such as
+// 0.0.0.0 for every interface.
+//
+int ListenForCoordinators(int port, const string &address = "127.0.0.1"); // Port 0 takes any free one
+int ListeningPort(int socket);
+void ServeCoordinators(int socket, ThreadPool*); // Until told to quit
+
+//
+// Cluster
+//
+// Coordinator of workers given as HOST:PORT, or just PORT on this host. The
+// children of a node are grown on the workers, each by its predicted share
+// of the nodes, largest first, up to MaxSubtreeNodes each, and their values
+// merged back into the tree.
+// Without workers they are grown one by one in this process, with the same
+// results.
+//
+class Cluster {
+public:
+	Cluster(const vector<string> &workers);
+	~Cluster();
+	// Sets the values of the node's children and its own from their subtrees
+	// grown on the workers. Returns the number of nodes grown.
+	size_t grow(Node*, size_t maxnodes, ThreadPool*);
+	int workers() const;
+	void quit(); // Stops the workers
+private:
+	vector<int> _sockets;
+};
+
+#endif // cluster_h
@@ -8,12 +8,21 @@
 #define StandardCapacity 40
 #define StandardDepth 2
 #define MinimumDepth 4 // plies
+#define MaxGrowthDepth 4 // plies grown below a terminal node at once
 #define MaxNumNodes 100000
 #define MaxNumTerminals 30
+#define ForkPlies 2 // plies above the subtrees split between threads
+#define NodeBatchSize 1024 // Nodes allocated or handed between threads at once
+#define MaxSubtreeNodes 10000000 // Grown by a worker for one request
+#define DefaultHashMegabytes 16
+#define MaxSearchDepth 64 // plies
+#define AspirationWindow 25
 #define WhiteMate 8192
 #define BlackMate (-WhiteMate)
 #define Stalemate 0
 #define PredictionSpread 120.0
+#define ExplorationWeight 1.5 // Of the prior against the mean value in PUCT
+#define VirtualLoss 1 // Playouts counted lost while in progress
 #define MaxMovesWithoutPawnMove 50
 #define DrawLevel 20
 
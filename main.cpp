@@ -5,6 +5,15 @@
 #include "board.h"
 #include "node.h"
 #include "move.h"
+#include "bench.h"
+#include "perft.h"
+#include "tt.h"
+#include "search.h"
+#include "pool.h"
+#include "mcts.h"
+#include "cluster.h"
+#include "softmax.h"
+#include "config.h"
 
 #include <atomic>
 #include <iostream>
@@ -15,14 +24,63 @@
 #include <queue>
 #include <list>
 #include <cstdio>
+#include <chrono>
+#include <sstream>
 
 using namespace std;
+using namespace std::chrono;
 
 atomic_size_t nodeCount; // Total number of nodes
-Node start(StandardDepth); // Initial position
-Node *current = &start; // Current position
+Node *current; // Current position
 std::list<Move> moves;
 std::string logfilename = "tchess.log";
+const char *benchname = 0;
+int perftdepth = 0;
+const char *fen = 0;
+bool divide = false;
+int threads = 1;
+int perfthash = 0; // Megabytes, 0 for no cache
+long perftexpected = -1; // Leaf count perft must find, if given
+int hashsize = DefaultHashMegabytes; // 0 for no transposition table
+int searchmode = SearchTree;
+size_t maxnodes = MaxNumNodes;
+int workerport = 0; // Serves coordinators on this port if given
+string workeraddress = "127.0.0.1"; // Listening for coordinators on
+vector<string> workers; // Grows the tree on these if given
+string searchstats; // Of the last move played by the program
+string growthstats; // Nodes grown below leaves of each priority band
+ThreadPool *pool; // Grows the tree
+
+//
+// priority bands
+//
+// Leaves are banded by the power of ten of their priority: 10% and over,
+// 1% to 10%, and so on down to the last band, for everything below.
+//
+#define PriorityBands 6
+int PriorityBand(float priority) {
+	int band = 0;
+	for (float limit = 0.1; band < PriorityBands-1 && priority < limit; limit /= 10) band++;
+	return band;
+}
+string StringForGrowth(const size_t *nodes) {
+	size_t total = 0;
+	for (int b = 0; b < PriorityBands; b++) total += nodes[b];
+	stringstream ss;
+	ss << "nodes grown by leaf priority:";
+	float percent = 10;
+	for (int b = 0; b < PriorityBands; b++) {
+		ss << (b ? ", " : " ");
+		if (b < PriorityBands-1) {
+			ss << ">=" << percent << "%: ";
+		} else {
+			ss << "<" << percent*10 << "%: ";
+		}
+		ss << nodes[b] << " (" << (total ? 100.0*nodes[b]/total : 0) << "%)";
+		percent /= 10;
+	}
+	return ss.str();
+}
 
 string GetResponse(const string &msg) {
 	cout << msg;
@@ -61,23 +119,53 @@ void PrintGame() {
 	cout << "\033[2J\033[H";
 	Frame("                            tchess                              ");
 	current->printGame(cout,moves);
+	if (!searchstats.empty()) cout << searchstats << '\n';
 	if (debug) {
 		int pres, cov, prot;
 		current->pos().pcpFor(white,&pres,&cov,&prot);
 		cout << "white ppcp: " << pres << ' ' << cov << ' ' << prot << '\n';
 		current->pos().pcpFor(black,&pres,&cov,&prot);
 		cout << "black ppcp: " << pres << ' ' << cov << ' ' << prot << '\n';
+		if (!growthstats.empty()) cout << growthstats << '\n';
 		cout << "intrinsic value: " << current->intrinsicValue() << "\n";
 		cout << "inherited value: " << current->value() << "\n";
+		if (TT) {
+			size_t probes = TT->probes();
+			cout << "transposition table: " << probes << " probes, "
+				<< (probes ? 100.0*TT->hits()/probes : 0) << "% hits\n";
+		}
 	}
 	cout << '\n';
 }
 void PrintHelp(void) {
-	cout << "Usage: tchess [--white] [--black] [--debug]\n";
-	cout << "   --white : User plays for white (default)\n";
-	cout << "   --black : User plays for black\n";
-	cout << "   --log   : Specify game log file (default: tchess.log)\n";
-	cout << "   --debug : Debug information is printed\n";
+	cout << "Usage: tchess [--white] [--black] [--log FILE] [--debug] [--hash MB] [--search=MODE] [--nodes N] [--threads N] [--workers LIST] [--bench NAME]\n";
+	cout << "       tchess --worker [ADDRESS:]PORT [--threads N] [--hash MB]\n";
+	cout << "       tchess --perft N [--fen FEN] [--divide] [--threads N] [--perft-hash MB] [--expect COUNT]\n";
+	cout << "   --white      : User plays for white (default)\n";
+	cout << "   --black      : User plays for black\n";
+	cout << "   --log        : Specify game log file (default: tchess.log)\n";
+	cout << "   --debug      : Debug information is printed\n";
+	cout << "   --hash       : Size of the transposition table in megabytes (default: " << DefaultHashMegabytes << ", 0 for none)\n";
+	cout << "   --search     : tree (default) grows the game tree best-first, ab searches alpha-beta, mcts plays out\n";
+	cout << "   --nodes      : Nodes the tree holds after growing, counting those kept from earlier moves;\n";
+	cout << "                  with ab, mcts or --workers, nodes to search or grow per move (default: " << MaxNumNodes << ")\n";
+	cout << "   --workers    : Grow the tree on workers, given as HOST:PORT or PORT separated by commas\n";
+	cout << "   --worker     : Grow trees for a coordinator connecting on the port, at the address (default: 127.0.0.1)\n";
+	cout << "   --bench      : Run the named benchmark (or all) and exit\n";
+	cout << "   --perft      : Count the leaf nodes N plies deep and exit\n";
+	cout << "   --fen        : Start from the given position instead of the initial one\n";
+	cout << "   --divide     : Print the perft count below each move\n";
+	cout << "   --threads    : Number of threads growing the tree, searching or counting perft (default: 1)\n";
+	cout << "   --perft-hash : Size of the perft cache in megabytes (default: none)\n";
+	cout << "   --expect     : Fail unless perft counts this many leaf nodes\n";
+}
+int IntArg(const char *arg) {
+	char *end;
+	long n = strtol(arg,&end,10);
+	if (*arg == 0 || *end != 0 || n < 0 || n > INT_MAX) {
+		throw runtime_error("expected a number command-line argument");
+	}
+	return n;
 }
 int main(int argc, char* argv[]) {
 	color playfor = black;
@@ -99,6 +187,34 @@ int main(int argc, char* argv[]) {
 				return 0;
 			} else if (strcmp(arg,"--log") == 0) {
 				argstate = 1;
+			} else if (strcmp(arg,"--bench") == 0) {
+				argstate = 2;
+			} else if (strcmp(arg,"--perft") == 0) {
+				argstate = 3;
+			} else if (strcmp(arg,"--fen") == 0) {
+				argstate = 4;
+			} else if (strcmp(arg,"--divide") == 0) {
+				divide = true;
+			} else if (strcmp(arg,"--threads") == 0) {
+				argstate = 5;
+			} else if (strcmp(arg,"--perft-hash") == 0) {
+				argstate = 6;
+			} else if (strcmp(arg,"--expect") == 0) {
+				argstate = 11;
+			} else if (strcmp(arg,"--hash") == 0) {
+				argstate = 7;
+			} else if (strcmp(arg,"--nodes") == 0) {
+				argstate = 8;
+			} else if (strcmp(arg,"--worker") == 0) {
+				argstate = 9;
+			} else if (strcmp(arg,"--workers") == 0) {
+				argstate = 10;
+			} else if (strcmp(arg,"--search=tree") == 0) {
+				searchmode = SearchTree;
+			} else if (strcmp(arg,"--search=ab") == 0) {
+				searchmode = SearchAlphaBeta;
+			} else if (strcmp(arg,"--search=mcts") == 0) {
+				searchmode = SearchMCTS;
 			} else {
 				throw runtime_error("unrecognized command-line argument");
 			}
@@ -107,6 +223,55 @@ int main(int argc, char* argv[]) {
 			logfilename = arg;
 			argstate = 0;
 			break;
+		case 2:
+			benchname = arg;
+			argstate = 0;
+			break;
+		case 3:
+			perftdepth = IntArg(arg);
+			argstate = 0;
+			break;
+		case 4:
+			fen = arg;
+			argstate = 0;
+			break;
+		case 5:
+			threads = IntArg(arg);
+			argstate = 0;
+			break;
+		case 6:
+			perfthash = IntArg(arg);
+			argstate = 0;
+			break;
+		case 7:
+			hashsize = IntArg(arg);
+			argstate = 0;
+			break;
+		case 8:
+			maxnodes = IntArg(arg);
+			argstate = 0;
+			break;
+		case 9: {
+			const char *colon = strrchr(arg,':');
+			if (colon) {
+				workeraddress = string(arg,colon - arg);
+				arg = colon + 1;
+			}
+			workerport = IntArg(arg);
+			argstate = 0;
+			break;
+		}
+		case 10: {
+			stringstream ss(arg);
+			string worker;
+			while (getline(ss,worker,',')) workers.push_back(worker);
+			argstate = 0;
+			break;
+		}
+		case 11:
+			perftexpected = IntArg(arg);
+			argstate = 0;
+			break;
 		default:
 			throw runtime_error("bad arg state");
 		}
@@ -114,6 +279,37 @@ int main(int argc, char* argv[]) {
 	if (argstate != 0) {
 		throw runtime_error("expected another command-line argument");
 	}
+	InitBoard();
+	InitSoftmax();
+	if (benchname) {
+		if (!RunBenchmark(benchname)) throw runtime_error("unknown benchmark");
+		return 0;
+	}
+	if (perftdepth) {
+		color turn = white;
+		int halfmoves = 0;
+		Position pos = fen ? Position::fromFEN(fen,&turn,&halfmoves) : Position::initialPosition();
+		Node root(pos,turn,0,halfmoves);
+		u64 count = RunPerft(&root,perftdepth,threads,perfthash,divide,cout);
+		if (perftexpected >= 0 && count != (u64)perftexpected) {
+			cerr << "perft " << perftdepth << ": expected " << perftexpected << " nodes\n";
+			return 1;
+		}
+		return 0;
+	}
+	if (hashsize) {
+		TT = new TranspositionTable(hashsize);
+		TT->countProbes(debug);
+	}
+	pool = new ThreadPool(threads);
+	if (workerport) {
+		int listener = ListenForCoordinators(workerport,workeraddress);
+		cout << "Worker listening on port " << ListeningPort(listener) << endl;
+		ServeCoordinators(listener,pool);
+		return 0;
+	}
+	Cluster *cluster = workers.size() ? new Cluster(workers) : 0;
+	current = new Node(StandardDepth); // Initial position
 	// TODO: check if exists
 	std::ofstream logfile;
 	logfile.open(logfilename,std::ios::out);
@@ -150,27 +346,61 @@ int main(int argc, char* argv[]) {
 			if (current->getColor() == playfor) {
 				// Play chess
 				cout << "Thinking...\n";
-				// Grow current node to minimum depth
-				current->grow(MinimumDepth);
-				// Use up all available memory
-				while (nodeCount < MaxNumNodes) {
-					// Re-evaluate entire tree
-					current->evaluate();
-					// Empty terminal node heap
-					numTerms = 0;
-					// Re-predict entire tree
-					current->predict(1.0);
-					if (numTerms == 0) break;
-					// Grow terminal nodes
-					for (int i = 1; i < numTerms+1; i++) {
-						terms[i]->grow(StandardDepth);
+				if (TT) TT->newSearch();
+				Move m;
+				stringstream stats;
+				if (searchmode == SearchAlphaBeta) {
+					// Search maxnodes nodes for this move on the main thread,
+					// unlike the tree, which holds maxnodes in all
+					LazySMP ab(current->pos(),current->getColor(),current->movesWithoutPawnMove(),threads);
+					PackedMove pm = ab.search(MaxSearchDepth,maxnodes);
+					stats << "Searched " << ab.depth() << " plies, " << ab.nodes() << " nodes at "
+						<< (ab.seconds() > 0 ? ab.nodes()/ab.seconds() : 0) << " nodes/s";
+					if (ab.threads() > 1) {
+						stats << " (";
+						for (int t = 0; t < ab.threads(); t++) {
+							stats << (t ? ", " : "") << (ab.seconds() > 0 ? ab.nodes(t)/ab.seconds() : 0);
+						}
+						stats << " per thread)";
 					}
+					current = current->playMove(pm,&m);
+					current->grow(1);
+				} else if (searchmode == SearchMCTS) {
+					// Grow maxnodes nodes for this move, keeping the playouts
+					// below the move played for the next one
+					MCTS mcts(current,pool);
+					PackedMove pm = mcts.search(maxnodes);
+					stats << "Played out " << mcts.playouts() << " times, " << nodeCount << " nodes in the tree, at "
+						<< (mcts.seconds() > 0 ? mcts.playouts()/mcts.seconds() : 0) << " playouts/s";
+					current = current->playMove(pm,&m);
+					current->grow(1);
+				} else if (cluster) {
+					// Grow the subtree below each move on the workers
+					steady_clock::time_point start = steady_clock::now();
+					size_t grown = cluster->grow(current,maxnodes,pool);
+					double secs = duration<double>(steady_clock::now() - start).count();
+					stats << "Grew " << grown << " nodes on " << cluster->workers() << " workers, at "
+						<< (secs > 0 ? grown/secs : 0) << " nodes/s";
+					current = current->playFor(current->getColor(),&m);
+					current->grow(1);
+				} else {
+					steady_clock::time_point start = steady_clock::now();
+					size_t startCount = nodeCount;
+					// Grow current node to minimum depth
+					current->grow(MinimumDepth);
+					size_t bandNodes[PriorityBands] = {};
+					current->growBestFirst(maxnodes,pool,[&](float priority, size_t grown) {
+						bandNodes[PriorityBand(priority)] += grown;
+					});
+					growthstats = StringForGrowth(bandNodes);
+					double secs = duration<double>(steady_clock::now() - start).count();
+					size_t grown = nodeCount - startCount;
+					stats << "Grew " << grown << " nodes, " << nodeCount << " in the tree, at "
+						<< (secs > 0 ? grown/secs : 0) << " nodes/s";
+					// Make a move
+					current = current->playFor(current->getColor(),&m);
 				}
-				// Re-evaluate entire tree
-				current->evaluate();
-				// Make a move
-				Move m;
-				current = current->playFor(current->getColor(),&m);
+				searchstats = stats.str();
 				moves.push_back(m);
 				logfile << m;
 				if (playfor == white) {
@@ -205,9 +435,7 @@ int main(int argc, char* argv[]) {
 						cout << "\tdraw - offers a draw\n";
 						continue;
 					}
-					try {
-						m = Move(resp.c_str());
-					} catch (BadMoveDesc &e) {
+					if (!ParseMove(resp.c_str(),&m)) {
 						cout << "Invalid move. Try again. ";
 						continue;
 					}
@@ -224,6 +452,7 @@ int main(int argc, char* argv[]) {
 						}
 						current->deleteChildrenExcept(inheritor);
 						current = inheritor;
+						current->grow(1); // To see whether the game is over
 						break;
 					} catch (AmbiguousMove &e) {
 						cout << "Ambiguous move. Try again. ";
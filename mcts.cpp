@@ -0,0 +1,114 @@
+//
+// mcts.cpp
+//
+
+#include "mcts.h"
+
+#include <chrono>
+#include <cmath>
+
+#include "config.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Playout value of a position value, for white
+static int64_t PlayoutValue(int value) {
+	return (int64_t)(tanhf(value/PredictionSpread)*MCTSUnit);
+}
+// Of a grown node without children
+static int TerminalValue(const Node *node) {
+	if (node->movesWithoutPawnMove() >= MaxMovesWithoutPawnMove) return Stalemate;
+	if (node->pos().inCheck(node->getColor())) return node->getColor() == white ? BlackMate : WhiteMate;
+	return Stalemate;
+}
+
+MCTS::MCTS(Node *root, ThreadPool *pool) : _root(root), _pool(pool), _playouts(0), _seconds(0) { }
+PackedMove MCTS::search(size_t maxnodes) {
+	steady_clock::time_point start = steady_clock::now();
+	_playouts = 0;
+	if (_root->grown() && _root->numChildren() == 0) return NoMove;
+	size_t endCount = nodeCount + maxnodes;
+	_pool->run(_pool->size(),[&](int) {
+		while (nodeCount < endCount && _playouts < maxnodes) playout();
+	});
+	_seconds = duration<double>(steady_clock::now() - start).count();
+	Node *best = 0;
+	for (size_t i = 0; i < _root->_children.size(); i++) {
+		Node *child = _root->_children[i];
+		if (!best || child->_visits > best->_visits) best = child;
+	}
+	return best ? best->_move : NoMove;
+}
+size_t MCTS::playouts() const { return _playouts; }
+double MCTS::seconds() const { return _seconds; }
+void MCTS::playout() {
+	Node *node = _root;
+	node->_visits.fetch_add(1,memory_order_relaxed);
+	while (node->_expansion.load(memory_order_acquire) == MCTSExpanded && node->_children.size()) {
+		node = select(node);
+		node->_visits.fetch_add(1,memory_order_relaxed);
+		node->_valueSum.fetch_sub(VirtualLoss*MCTSUnit,memory_order_relaxed);
+	}
+	int value;
+	u8 expected = MCTSNotExpanded;
+	if (node->_expansion.load(memory_order_acquire) == MCTSExpanded) {
+		value = TerminalValue(node);
+	} else if (node->_expansion.compare_exchange_strong(expected,MCTSExpanding)) {
+		value = expand(node);
+	} else {
+		value = node->_value; // Set when its parent was expanded
+	}
+	// Each node's sum is for the side that moved to it, and takes back the
+	// virtual loss
+	int64_t result = PlayoutValue(value);
+	for (; node != _root; node = node->_parent) {
+		int64_t r = node->_parent->_color == white ? result : -result;
+		node->_valueSum.fetch_add(r + VirtualLoss*MCTSUnit,memory_order_relaxed);
+	}
+	_playouts.fetch_add(1,memory_order_relaxed);
+}
+// PUCT: children not yet visited take their own value as their mean
+Node *MCTS::select(Node *node) const {
+	float sqrtVisits = sqrtf((float)node->_visits.load(memory_order_relaxed));
+	float sign = node->_color == white ? 1 : -1;
+	Node *best = 0;
+	float bestScore = 0;
+	for (size_t i = 0; i < node->_children.size(); i++) {
+		Node *child = node->_children[i];
+		u32 visits = child->_visits.load(memory_order_relaxed);
+		float mean;
+		if (visits) {
+			mean = (float)child->_valueSum.load(memory_order_relaxed)/((float)visits*MCTSUnit);
+		} else {
+			mean = tanhf(sign*child->_value/PredictionSpread);
+		}
+		float score = mean + ExplorationWeight*child->_share*sqrtVisits/(1 + visits);
+		if (!best || score > bestScore) {
+			best = child;
+			bestScore = score;
+		}
+	}
+	return best;
+}
+// The children get their intrinsic values and their shares before any other
+// thread can see them
+int MCTS::expand(Node *node) {
+	node->grow(1);
+	int value;
+	if (node->_children.size() == 0) {
+		value = TerminalValue(node);
+	} else {
+		value = 0;
+		for (size_t i = 0; i < node->_children.size(); i++) {
+			Node *child = node->_children[i];
+			child->_value = child->intrinsicValue();
+			if (i == 0 || (node->_color == white ? child->_value > value : child->_value < value)) {
+				value = child->_value;
+			}
+		}
+		node->predictChildren();
+	}
+	node->_expansion.store(MCTSExpanded,memory_order_release);
+	return value;
+}
@@ -0,0 +1,53 @@
+//
+// mcts.h
+// Monte-Carlo tree search
+//
+
+#ifndef mcts_h
+#define mcts_h
+
+#include <atomic>
+
+#include "node.h"
+#include "pool.h"
+
+using namespace std;
+
+#define MCTSUnit 65536 // Value of a won playout, -MCTSUnit for a lost one
+
+//
+// MCTS
+//
+// Monte-Carlo tree search over the game tree. Each playout follows the child
+// with the best PUCT score, the mean value of its playouts plus its share
+// (as Node::predict splits priority) weighed against how often it has been
+// visited, down to a node that has not been expanded. That node is grown a
+// ply and valued by the best of its children, and the value is added to
+// every node on the way.
+//
+// Playouts run on all of the pool's threads at once, without locks. Visit
+// counts and value sums are atomic, and a playout counts as VirtualLoss lost
+// playouts until it is done, so that the threads spread over the tree. A node
+// is expanded by the first thread to reach it, and is a leaf to the others
+// until it is done.
+//
+class MCTS {
+public:
+	MCTS(Node *root, ThreadPool*);
+	// Plays out until maxnodes nodes have been grown or there have been as
+	// many playouts, and returns the move to the most visited child. NoMove
+	// if there are no legal moves.
+	PackedMove search(size_t maxnodes);
+	size_t playouts() const;
+	double seconds() const;
+private:
+	void playout();
+	Node *select(Node*) const;
+	int expand(Node*); // Returns the value of the node
+	Node *_root;
+	ThreadPool *_pool;
+	atomic_size_t _playouts;
+	double _seconds;
+};
+
+#endif // mcts_h
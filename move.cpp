@@ -4,182 +4,141 @@
 
 #include "move.h"
 
-#include <cctype>
+#include <ostream>
 #include <string>
-#include <cstring>
-#include <sstream>
 
 using namespace std;
 
 BadMoveDesc::BadMoveDesc() : runtime_error("Bad move descriptor") { }
 
-static bool IsWhiteString(const char *str) {
-	for (int i = 0; str[i] != 0; i++) if (!isspace(str[i])) return false;
-	return true;
-}
 Move::Move() : piecechar(0), file(0), rank(0), takes(0), to(0), special(0), promotionchar(0), check(0) { }
 Move::Move(const string &s) : Move(s.c_str()) { }
 Move::Move(const char *msg) : Move() {
-	// Skip leading whitespace
-	for (; isspace(*msg); msg++);
-	// Determine format
-	if (IsFileChar(msg[0]) && // e4
-			IsRankChar(msg[1]) &&
-			IsWhiteString(msg+2)) {
-		piecechar = pawn;
-		to = SquareWithFileAndRankChars(msg[0],msg[1]);
-	} else if (IsFileChar(msg[0]) && // e4=Q
-			IsRankChar(msg[1]) &&
-			msg[2] == '=' &&
-			IsPromotionChar(msg[3]) &&
-			IsWhiteString(msg+4)) {
-		piecechar = pawn;
-		to = SquareWithFileAndRankChars(msg[0],msg[1]);
-		promotionchar = msg[3];
-	} else if (msg[0] == 'x' && // xe4
-			IsFileChar(msg[1]) &&
-			IsRankChar(msg[2]) &&
-			IsWhiteString(msg+3)) {
-		piecechar = pawn;
-		takes = 1;
-		to = SquareWithFileAndRankChars(msg[1],msg[2]);
-	} else if (msg[0] == 'x' && // xe4=Q
-			IsFileChar(msg[1]) &&
-			IsRankChar(msg[2]) &&
-			msg[3] == '=' &&
-			IsPromotionChar(msg[4]) &&
-			IsWhiteString(msg+5)) {
-		piecechar = pawn;
-		takes = 1;
-		to = SquareWithFileAndRankChars(msg[1],msg[2]);
-		promotionchar = msg[4];
-	} else if (IsFileChar(msg[0]) && // dxe4
-			msg[1] == 'x' &&
-			IsFileChar(msg[2]) &&
-			IsRankChar(msg[3]) &&
-			IsWhiteString(msg+4)) {
-		piecechar = pawn;
-		file = msg[0];
-		takes = 1;
-		to = SquareWithFileAndRankChars(msg[2],msg[3]);
-	} else if (IsFileChar(msg[0]) && // dxe4=Q
-			msg[1] == 'x' &&
-			IsFileChar(msg[2]) &&
-			IsRankChar(msg[3]) &&
-			msg[4] == '=' &&
-			IsPromotionChar(msg[5]) &&
-			IsWhiteString(msg+6)) {
-		piecechar = pawn;
-		file = msg[0];
-		takes = 1;
-		to = SquareWithFileAndRankChars(msg[2],msg[3]);
-		promotionchar = msg[5];
-	} else if (IsFileChar(msg[0]) && // e4xd5
-			IsRankChar(msg[1]) &&
-			msg[2] == 'x' &&
-			IsFileChar(msg[3]) &&
-			IsRankChar(msg[4]) &&
-			IsWhiteString(msg+5)) {
-		piecechar = pawn;
-		file = msg[0];
-		rank = msg[1];
-		takes = 1;
-		to = SquareWithFileAndRankChars(msg[3],msg[4]);
-	} else if (IsFileChar(msg[0]) && // e4xd5=Q
-			IsRankChar(msg[1]) &&
-			msg[2] == 'x' &&
-			IsFileChar(msg[3]) &&
-			IsRankChar(msg[4]) &&
-			msg[5] == '=' &&
-			IsPromotionChar(msg[6]) &&
-			IsWhiteString(msg+7)) {
-		piecechar = pawn;
-		file = msg[0];
-		rank = msg[1];
-		takes = 1;
-		to = SquareWithFileAndRankChars(msg[3],msg[4]);
-		promotionchar = msg[6];
-	} else if (IsPieceChar(msg[0]) &&	// Be5
-			IsFileChar(msg[1]) &&
-			IsRankChar(msg[2]) &&
-			IsWhiteString(msg+3)) {
-		piecechar = msg[0];
-		to = SquareWithFileAndRankChars(msg[1],msg[2]);
-	} else if (IsPieceChar(msg[0]) && // Bxe5
-			msg[1] == 'x' &&
-			IsFileChar(msg[2]) &&
-			IsRankChar(msg[3]) &&
-			IsWhiteString(msg+4)) {
-		piecechar = msg[0];
-		takes = 1;
-		to = SquareWithFileAndRankChars(msg[2],msg[3]);
-	} else if (IsPieceChar(msg[0]) && // Bde5
-			IsFileChar(msg[1]) &&
-			IsFileChar(msg[2]) &&
-			IsRankChar(msg[3]) &&
-			IsWhiteString(msg+4)) {
-		piecechar = msg[0];
-		file = msg[1];
-		to = SquareWithFileAndRankChars(msg[2],msg[3]);
-	} else if (IsPieceChar(msg[0]) && // Bdxe5
-			IsFileChar(msg[1]) &&
-			msg[2] == 'x' &&
-			IsFileChar(msg[3]) &&
-			IsRankChar(msg[4]) &&
-			IsWhiteString(msg+5)) {
-		piecechar = msg[0];
-		file = msg[1];
-		takes = 1;
-		to = SquareWithFileAndRankChars(msg[3],msg[4]);
-	} else if (IsPieceChar(msg[0]) && // Bd4e5
-			IsFileChar(msg[1]) &&
-			IsRankChar(msg[2]) &&
-			IsFileChar(msg[3]) &&
-			IsRankChar(msg[4]) &&
-			IsWhiteString(msg+5)) {
-		piecechar = msg[0];
-		file = msg[1];
-		rank = msg[2];
-		to = SquareWithFileAndRankChars(msg[3],msg[4]);
-	} else if (IsPieceChar(msg[0]) && // Bd4xe5
-			IsFileChar(msg[1]) &&
-			IsRankChar(msg[2]) &&
-			msg[3] == 'x' &&
-			IsFileChar(msg[4]) &&
-			IsRankChar(msg[5]) &&
-			IsWhiteString(msg+6)) {
-		piecechar = msg[0];
-		file = msg[1];
-		rank = msg[2];
-		takes = 1;
-		to = SquareWithFileAndRankChars(msg[4],msg[5]);
-	} else if (strncmp(msg,"0-0",3) == 0 && IsWhiteString(msg+3)) {
-		special = smCastleKingside;
-	} else if (strncmp(msg,"0-0-0",5) == 0 && IsWhiteString(msg+5)) {
-		special = smCastleQueenside;
-	} else {
-		throw BadMoveDesc();
-	}
+	if (!ParseMove(msg,this)) throw BadMoveDesc();
 }
 Move::operator string() const {
-	if (special & smCastleKingside) {
-		return string("0-0");
+	char buf[MoveStringSize];
+	int len = FormatMove(*this,buf);
+	return string(buf,len);
+}
+ostream& operator<<(ostream &out, const Move &move) {
+	char buf[MoveStringSize];
+	int len = FormatMove(move,buf);
+	return out.write(buf,len);
+}
+
+//
+// Notation
+//
+#define ccFile 0x01
+#define ccRank 0x02
+#define ccPiece 0x04
+#define ccPromotion 0x08
+#define ccSpace 0x10
+#define ccCheck 0x20
+#define ccCastle 0x40
+struct CharClassTable {
+	constexpr CharClassTable() : classes() {
+		for (int c = 'a'; c <= 'h'; c++) classes[c] |= ccFile;
+		for (int c = '1'; c <= '8'; c++) classes[c] |= ccRank;
+		classes[(int)pawn] |= ccPiece;
+		classes[(int)rook] |= ccPiece | ccPromotion;
+		classes[(int)knight] |= ccPiece | ccPromotion;
+		classes[(int)bishop] |= ccPiece | ccPromotion;
+		classes[(int)queen] |= ccPiece | ccPromotion;
+		classes[(int)king] |= ccPiece;
+		classes[(int)' '] = classes[(int)'\t'] = classes[(int)'\n'] = ccSpace;
+		classes[(int)'\v'] = classes[(int)'\f'] = classes[(int)'\r'] = ccSpace;
+		classes[(int)'+'] = classes[(int)'#'] = ccCheck;
+		classes[(int)'0'] = classes[(int)'O'] = ccCastle;
 	}
-	if (special & smCastleQueenside) {
-		return string("0-0-0");
+	u8 operator[](unsigned char c) const { return classes[c]; }
+	u8 classes[256];
+};
+static constexpr CharClassTable CharClasses;
+
+// [piece][file][rank][x]<file><rank>[=promotion][+|#], or 0-0 and 0-0-0
+// (also O-O and O-O-O), with optional surrounding whitespace. A pawn move
+// names no piece, and the origin file and rank, when needed, are optional
+// independently of each other.
+bool ParseMove(const char *str, Move *m) {
+	const unsigned char *s = (const unsigned char*)str;
+	*m = Move();
+	while (CharClasses[*s] & ccSpace) s++;
+	if (CharClasses[*s] & ccCastle) {
+		unsigned char o = *s;
+		if (s[1] != '-' || s[2] != o) return false;
+		s += 3;
+		m->special = smCastleKingside;
+		if (s[0] == '-' && s[1] == o) {
+			s += 2;
+			m->special = smCastleQueenside;
+		}
+	} else {
+		if (CharClasses[*s] & ccPiece) {
+			if (*s != pawn) m->piecechar = *s;
+			s++;
+		}
+		// Up to two squares, each possibly partial: the origin, if given,
+		// and the destination
+		char file = 0, rank = 0;
+		if (CharClasses[*s] & ccFile) file = *s++;
+		if (CharClasses[*s] & ccRank) rank = *s++;
+		if (*s == 'x') {
+			m->takes = 1;
+			s++;
+		}
+		if ((CharClasses[s[0]] & ccFile) && (CharClasses[s[1]] & ccRank)) {
+			m->file = file;
+			m->rank = rank;
+			m->to = SquareWithFileAndRankChars(s[0],s[1]);
+			s += 2;
+		} else if (file && rank && !m->takes) {
+			m->to = SquareWithFileAndRankChars(file,rank);
+		} else {
+			return false;
+		}
+		if (*s == '=') {
+			if (m->piecechar || !(CharClasses[s[1]] & ccPromotion)) return false;
+			m->promotionchar = s[1];
+			s += 2;
+		}
 	}
-	stringstream ss;
-	if (piecechar) ss << string(1,piecechar);
-	if (file) ss << string(1,file);
-	if (rank) ss << string(1,rank);
-	if (takes) ss << string(1,'x');
-	ss << string(1,FileCharForSquare(to)) << string(1,RankCharForSquare(to));
-	if (promotionchar) {
-		ss << string("=") << string(1,promotionchar);
+	if (CharClasses[*s] & ccCheck) {
+		m->check = 1;
+		s++;
 	}
-	if (check) ss << string(1,'+');
-	return ss.str();
+	while (CharClasses[*s] & ccSpace) s++;
+	return *s == 0;
 }
-ostream& operator<<(ostream &out, const Move &move) {
-	return out << string(move);
+int FormatMove(const Move &m, char *buf) {
+	char *s = buf;
+	if (m.special & (smCastleKingside|smCastleQueenside)) {
+		*s++ = '0';
+		*s++ = '-';
+		*s++ = '0';
+		if (m.special & smCastleQueenside) {
+			*s++ = '-';
+			*s++ = '0';
+		}
+		*s = 0;
+		return s - buf;
+	}
+	if (m.piecechar) *s++ = m.piecechar;
+	if (m.file) *s++ = m.file;
+	if (m.rank) *s++ = m.rank;
+	if (m.takes) *s++ = 'x';
+	*s++ = FileCharForSquare(m.to);
+	*s++ = RankCharForSquare(m.to);
+	if (m.promotionchar) {
+		*s++ = '=';
+		*s++ = m.promotionchar;
+	}
+	if (m.check) *s++ = '+';
+	*s = 0;
+	return s - buf;
+}
+char PackedMove::promotionChar() const {
+	if (!promotion()) return 0;
+	return PromotionCharForIdx((bits >> PMSpecialShift) & 3);
 }
@@ -21,7 +21,7 @@ struct Move {
 	Move();
 	Move(const char*);
 	Move(const string&);
-	char piecechar;
+	char piecechar; // 0 for a pawn
 	char file;
 	char rank;
 	u8 takes;
@@ -36,5 +36,55 @@ struct Move {
 	operator string() const;
 };
 ostream& operator<<(ostream&,const Move&);
+// Reads algebraic notation in a single pass. Returns false, with the move
+// unspecified, if the string is not a move.
+bool ParseMove(const char*, Move*);
+// Writes the notation and a terminating null into a buffer of at least
+// MoveStringSize chars. Returns the length.
+#define MoveStringSize 9 // Longest is e7xd8=Q+
+int FormatMove(const Move&, char*);
+
+//
+// PackedMove
+//
+// A move in 16 bits: origin square in the low 6, destination in the next 6,
+// then the flags. For a promotion, bits 12-13 hold the promotion index
+// (IdxForPromotionChar); for castling they hold smCastleKingside or
+// smCastleQueenside and the squares are the king's.
+//
+#define PMTakes 0x4000
+#define PMPromotion 0x8000
+#define PMSpecialShift 12
+#define PMCastleKingside (smCastleKingside << PMSpecialShift)
+#define PMCastleQueenside (smCastleQueenside << PMSpecialShift)
+struct PackedMove {
+	PackedMove() = default; // Left uninitialized, so that move lists are cheap
+	PackedMove(square from, square to, u16 flags = 0) : bits(from | to << 6 | flags) { }
+	square from() const { return bits & 0x3f; }
+	square to() const { return (bits >> 6) & 0x3f; }
+	bool takes() const { return bits & PMTakes; }
+	bool promotion() const { return bits & PMPromotion; }
+	char promotionChar() const; // 0 if not a promotion
+	u8 castle() const { return promotion() ? 0 : (bits >> PMSpecialShift) & 3; }
+	bool operator==(PackedMove m) const { return bits == m.bits; }
+	bool operator!=(PackedMove m) const { return bits != m.bits; }
+	u16 bits;
+};
+#define NoMove PackedMove(0,0)
+
+//
+// MoveList
+//
+// Fixed capacity list for the legal moves of a position, meant to live on the
+// stack
+//
+#define MaxMoves 256 // No position has more than 218 legal moves
+struct MoveList {
+	MoveList() : size(0) { }
+	void push(PackedMove m) { moves[size++] = m; }
+	PackedMove operator[](int i) const { return moves[i]; }
+	PackedMove moves[MaxMoves];
+	int size;
+};
 
 #endif // move_h
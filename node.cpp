@@ -6,8 +6,12 @@
 
 #include "config.h"
 #include "board.h"
+#include "softmax.h"
+#include "tt.h"
+#include "pool.h"
 
-#include <cmath>
+#include <climits>
+#include <mutex>
 #include <vector>
 
 using namespace std;
@@ -17,13 +21,19 @@ IllegalMove::IllegalMove() : BadMove("Illegal move") { }
 AmbiguousMove::AmbiguousMove() : BadMove("Ambiguous move") { }
 
 Node::Node(Node *parent, const Position& p, color turn, int depth, SpecialType special) :
-		_value(0), _parent(parent), _pos(p), _children(0), _priority(0), _special(special),
-		_color(turn) {
+		_value(0), _parent(parent), _pos(p), _children(0), _priority(0), _share(0), _frontier(1), _special(special),
+		_move(NoMove), _color(turn), _visits(0), _valueSum(0), _expansion(MCTSNotExpanded) {
 	grow(depth);
 }
 Node::Node(int depth) : _value(0), _parent(0),
-		_pos(Position::initialPosition()), _children(0), _priority(0), _special(0),
-		_color(white) {
+		_pos(Position::initialPosition()), _children(0), _priority(0), _share(0), _frontier(1), _special(0),
+		_move(NoMove), _color(white), _visits(0), _valueSum(0), _expansion(MCTSNotExpanded) {
+	grow(depth);
+}
+Node::Node(const Position& p, color turn, int depth, int movesWithoutPawnMove) :
+		_value(0), _parent(0), _pos(p), _children(0), _priority(0), _share(0), _frontier(1),
+		_special((movesWithoutPawnMove << MovesWithoutPawnMoveShift) & MovesWithoutPawnMoveMask),
+		_move(NoMove), _color(turn), _visits(0), _valueSum(0), _expansion(MCTSNotExpanded) {
 	grow(depth);
 }
 Node::~Node() {
@@ -32,301 +42,400 @@ Node::~Node() {
 	}
 	nodeCount -= _children.size();
 }
+// Each thread keeps the nodes it frees for reuse. Beyond two batches it hands
+// one batch over to the shared list, which threads that run out of nodes take
+// from before allocating a new batch. A thread that exits hands over all the
+// nodes it has left.
+struct FreeNode {
+	FreeNode *next;
+};
+struct FreeBatch {
+	FreeNode *nodes;
+	size_t num;
+};
+struct FreeNodesOwner {
+	FreeNodesOwner() { }
+	~FreeNodesOwner();
+};
+static thread_local FreeNode *freeNodes = 0;
+static thread_local size_t numFreeNodes = 0;
+static thread_local FreeNodesOwner freeNodesOwner; // Touched once a thread has nodes
+static mutex sharedNodesLock;
+// Never destroyed, since threads may exit after static destructors have run
+static vector<FreeBatch> &sharedNodes = *new vector<FreeBatch>; // Mostly of NodeBatchSize
+FreeNodesOwner::~FreeNodesOwner() {
+	if (!freeNodes) return;
+	lock_guard<mutex> lock(sharedNodesLock);
+	FreeBatch b = { freeNodes, numFreeNodes };
+	sharedNodes.push_back(b);
+	freeNodes = 0;
+	numFreeNodes = 0;
+}
+struct TTStore {
+	u64 key;
+	TTEntry e;
+};
+void *Node::operator new(size_t size) {
+	if (!freeNodes) {
+		(void)&freeNodesOwner;
+		lock_guard<mutex> lock(sharedNodesLock);
+		if (sharedNodes.size()) {
+			freeNodes = sharedNodes.back().nodes;
+			numFreeNodes = sharedNodes.back().num;
+			sharedNodes.pop_back();
+		} else {
+			char *batch = (char*)::operator new(size*NodeBatchSize);
+			for (size_t i = 0; i < NodeBatchSize; i++) {
+				FreeNode *f = (FreeNode*)(batch + i*size);
+				f->next = freeNodes;
+				freeNodes = f;
+			}
+			numFreeNodes = NodeBatchSize;
+		}
+	}
+	FreeNode *f = freeNodes;
+	freeNodes = f->next;
+	numFreeNodes--;
+	return f;
+}
+void Node::operator delete(void *p) {
+	FreeNode *f = (FreeNode*)p;
+	if (!freeNodes) (void)&freeNodesOwner;
+	f->next = freeNodes;
+	freeNodes = f;
+	if (++numFreeNodes < 2*NodeBatchSize) return;
+	FreeNode *last = freeNodes;
+	for (size_t i = 1; i < NodeBatchSize; i++) last = last->next;
+	lock_guard<mutex> lock(sharedNodesLock);
+	FreeBatch b = { freeNodes, NodeBatchSize };
+	sharedNodes.push_back(b);
+	freeNodes = last->next;
+	last->next = 0;
+	numFreeNodes -= NodeBatchSize;
+}
 const Node* Node::parent() const { return _parent; }
-void Node::addPosition(const Position &pos, int depth, SpecialType special) {
-	// Can't put yourself in check
-	if (pos.inCheck(_color)) return;
-	Node *node = new Node(this,pos,OppositeColor(_color),depth-1,special);
+PackedMove Node::move() const { return _move; }
+void Node::addChild(PackedMove m, SpecialType special) {
+	// The child starts out ungrown, so _pos can be taken back before it grows
+	Node *node = new Node(this,_pos,OppositeColor(_color),0,special);
 	if (node == 0) throw runtime_error("failed to allocate node");
+	node->_move = m;
 	_children.push_back(node);
 }
-void Node::addAllMoves(piece p, square *squares, int depth, u16 special) {
-	// Find all legal moves and add as children
-	Position pos;
-	for (int j = 0; squares[j] != nosquare; j++) {
-		pos = _pos;
-		if (squares[j] & TakesMask) {
-			pos.takePiece(p,squares[j] & ~TakesMask);
-		} else {
-			pos.movePiece(p,squares[j]);
-		}
-		addPosition(pos,depth,special);
-	}
-}
-void Node::grow(int depth) {
-	if (depth == 0) return;
+size_t Node::grow(int depth) {
+	if (depth == 0) return 0;
+	size_t added = 0;
 	if (grown()) {
 		for (size_t i = 0; i < _children.size(); i++) {
-			_children[i]->grow(depth-1);
+			added += _children[i]->grow(depth-1);
 		}
-		return;
+		return added;
 	}
 	_special |= GrownMask;
 	if (movesWithoutPawnMove() >= MaxMovesWithoutPawnMove) {
-		return;
-	}
-	_children.reserve(StandardCapacity);
-	// Generate all valid moves
-	square squares[29];
-	piece p;
-	Position pos;
-	// Castling
-	if (_color == white) {
-		// White castle
-		if (whiteCanCastleKingside()) {
-			if (_pos.squareEmpty(sq_f1) &&
-				_pos.squareEmpty(sq_g1) &&
-				_pos.pieceForSquareAndColor(sq_h1,_color) == white_r2) {
-				pos = _pos;
-				pos.movePiece(white_k,sq_g1);
-				pos.movePiece(white_r2,sq_f1);
-				addPosition(pos,depth,nextSpecial() |
-						WhiteCanCastleKingsideMask |
-						WhiteCanCastleQueensideMask);
-			}
-		}
-		if (whiteCanCastleQueenside()) {
-			if (_pos.squareEmpty(sq_d1) &&
-				_pos.squareEmpty(sq_c1) &&
-				_pos.squareEmpty(sq_b1) &&
-				_pos.pieceForSquareAndColor(sq_a1,_color) == white_r1) {
-				pos = _pos;
-				pos.movePiece(white_k,sq_c1);
-				pos.movePiece(white_r1,sq_d1);
-				addPosition(pos,depth,nextSpecial() |
-						WhiteCanCastleKingsideMask |
-						WhiteCanCastleQueensideMask);
-			}
-		}
-		p = 0;
-	} else {
-		// Black castle
-		if (blackCanCastleKingside()) {
-			if (_pos.squareEmpty(sq_f8) &&
-				_pos.squareEmpty(sq_g8) &&
-				_pos.pieceForSquareAndColor(sq_h8,_color) == black_r2) {
-				pos = _pos;
-				pos.movePiece(black_k,sq_g8);
-				pos.movePiece(black_r2,sq_f8);
-				addPosition(pos,depth,nextSpecial() |
-						BlackCanCastleKingsideMask |
-						BlackCanCastleQueensideMask);
-			}
-		}
-		if (blackCanCastleQueenside()) {
-			if (_pos.squareEmpty(sq_d8) &&
-				_pos.squareEmpty(sq_c8) &&
-				_pos.squareEmpty(sq_b8) &&
-				_pos.pieceForSquareAndColor(sq_a8,_color) == black_r1) {
-				pos = _pos;
-				pos.movePiece(black_k,sq_c8);
-				pos.movePiece(black_r1,sq_d8);
-				addPosition(pos,depth,nextSpecial() |
-						BlackCanCastleKingsideMask |
-						BlackCanCastleQueensideMask);
-			}
-		}
-		p = 16;
-	}
-	// Generate pawn moves
-	for (; !(p & 8); p++) {
-		square ps = _pos.squareForPiece(p);
-		if (ps & TakenMask) continue;
-		if (ps & PromotionMask) {
-			// Promoted pawns
-			char pc = _pos.promotionCharForPromotedPawn(p);
-			switch (pc) {
-			case 'N': knightMoves(ps & ~PromotionMask,squares); break;
-			case 'B': bishopMoves(ps & ~PromotionMask,squares); break;
-			case 'R': rookMoves(ps & ~PromotionMask,squares); break;
-			case 'Q': queenMoves(ps & ~PromotionMask,squares); break;
-			default: throw runtime_error("bad promotion char");
-			}
-			addAllMoves(p,squares,depth,nextSpecial());
-			continue;
-		}
-		pawnMoves(ps,squares);
-		for (int i = 0; squares[i] != nosquare; i++) {
-			Position pos = _pos;
-			if (squares[i] & TakesMask) {
-				pos.takePiece(p,squares[i] & ~TakesMask);
-			} else {
-				pos.movePiece(p,squares[i]);
-			}
-			int ri = RankIdxForSquare(squares[i] & 0x3f);
-			if (ri == 0 || ri == 7) {
-				// Promotion on last ranks
-				Position pos2 = pos;
-				pos2.promotePawn(p,'N');
-				addPosition(pos2,depth,nextSpecialWithMovesWithoutPawnMove(0));
-				pos2 = pos;
-				pos2.promotePawn(p,'B');
-				addPosition(pos2,depth,nextSpecialWithMovesWithoutPawnMove(0));
-				pos2 = pos;
-				pos2.promotePawn(p,'R');
-				addPosition(pos2,depth,nextSpecialWithMovesWithoutPawnMove(0));
-				pos2 = pos;
-				pos2.promotePawn(p,'Q');
-				addPosition(pos2,depth,nextSpecialWithMovesWithoutPawnMove(0));
-			} else {
-				addPosition(pos,depth,nextSpecialWithMovesWithoutPawnMove(0));
-			}
-		}
-		int ri = RankIdxForSquare(ps);
-		if (ri == 3 && _color == black && _parent) {
-			// TODO: en passant
-			if (HasSquareLeft(ps)) {
-				char lpc = PieceCharForIdx(_pos.pieceForSquareAndColor(SquareLeft(ps),white));
-				char plpc = PieceCharForIdx(_parent->_pos.pieceForSquareAndColor(SquareLeft(ps),white));
-				if (lpc == pawn && plpc != pawn) { // Pawn moved into left square
-
-				}
-			}
-		} else if (ri == 4 && _color == white && _parent) {
-
-		}
-	}
-	// Generate rook moves
-	// Queen's rook
-	square rs = _pos.squareForPiece(p);
-	if (!(rs & TakenMask)) {
-		rookMoves(rs,squares);
-		if (_color == white) {
-			addAllMoves(p,squares,depth,nextSpecial() & ~WhiteCanCastleQueensideMask);
+		return 0;
+	}
+	MoveList moves;
+	_pos.legalMoves(_color,&moves);
+	_children.reserve(moves.size);
+	u64 pawns = _pos._pieces[_color][KindPawn];
+	for (int i = 0; i < moves.size; i++) {
+		PackedMove m = moves[i];
+		Position::Undo undo;
+		_pos.makeMove(m,&undo);
+		if (pawns & ((u64)1 << m.from())) {
+			addChild(m,nextSpecialWithMovesWithoutPawnMove(0));
 		} else {
-			addAllMoves(p,squares,depth,nextSpecial() & ~BlackCanCastleQueensideMask);
+			addChild(m,nextSpecial());
 		}
+		_pos.unmakeMove(undo);
 	}
-	p++;
-	// King's rook
-	rs = _pos.squareForPiece(p);
-	if (!(rs & TakenMask)) {
-		rookMoves(rs,squares);
-		if (_color == white) {
-			addAllMoves(p,squares,depth,nextSpecial() & ~WhiteCanCastleKingsideMask);
-		} else {
-			addAllMoves(p,squares,depth,nextSpecial() & ~BlackCanCastleKingsideMask);
-		}
-	}
-	p++;
-	// Generate knight moves
-	for (; p & 2; p++) {
-		square ns = _pos.squareForPiece(p);
-		if (ns & TakenMask) continue;
-		knightMoves(ns,squares);
-		addAllMoves(p,squares,depth,nextSpecial());
-	}
-	// Generate bishop moves
-	for (; !(p & 2); p++) {
-		square bs = _pos.squareForPiece(p);
-		if (bs & TakenMask) continue;
-		bishopMoves(bs,squares);
-		addAllMoves(p,squares,depth,nextSpecial());
-	}
-	// Generate queen moves
-	square qs = _pos.squareForPiece(p);
-	if (!(qs & TakenMask)) {
-		queenMoves(qs,squares);
-		addAllMoves(p,squares,depth,nextSpecial());
-	}
-	p++;
-	// Generate king moves
-	square ks = _pos.squareForPiece(p);
-	kingMoves(ks,squares);
-	addAllMoves(p,squares,depth,nextSpecial() |
-			(_color == white ?
-			 WhiteCanCastleKingsideMask | WhiteCanCastleQueensideMask :
-			 BlackCanCastleKingsideMask | BlackCanCastleQueensideMask));
-	_children.shrink_to_fit();
 	nodeCount += _children.size();
+	added = _children.size();
+	// Grow the children only now that _pos is back to this node's position
+	for (size_t i = 0; i < _children.size(); i++) {
+		added += _children[i]->grow(depth-1);
+	}
+	return added;
+}
+size_t Node::growWithin(size_t nodes) {
+	size_t added = grow(1);
+	// Each further ply is taken to branch like the first
+	size_t branching = _children.size() > 2 ? _children.size() : 2;
+	int depth = 1;
+	for (size_t size = branching*branching; depth < MaxGrowthDepth && size <= nodes; size *= branching) {
+		depth++;
+	}
+	return added + grow(depth);
 }
 bool Node::grown() const {
 	return _special & GrownMask;
 }
 int Node::evaluate() {
-	if (!grown()) {
-		_value = intrinsicValue();
-	} else if (_color == white) {
-		if (_children.size() == 0) {
-			if (_pos.inCheck(white)) {
-				return _value = BlackMate;
-			}
-			return Stalemate;
+	return evaluate(0);
+}
+// Table entries are stored once the pass is over, so that no leaf sees an
+// entry stored by a subtree that another thread may or may not have reached,
+// and the serial pass sees the same. They are stored subtree by subtree in
+// the order the subtrees were taken, then for the nodes above them.
+int Node::evaluate(ThreadPool *pool) {
+	vector<Node*> forks;
+	collectForks(0,&forks);
+	vector<int> depths(forks.size());
+	vector<vector<TTStore>> logs(forks.size() + 1);
+	auto task = [&](int i) {
+		forks[i]->evaluate(&depths[i],&logs[i]);
+	};
+	if (pool) {
+		pool->run(forks.size(),task);
+	} else {
+		for (size_t i = 0; i < forks.size(); i++) task(i);
+	}
+	int depth, next = 0;
+	evaluateAbove(0,depths.data(),&next,&depth,&logs[forks.size()]);
+	if (TT) {
+		for (size_t i = 0; i < logs.size(); i++) {
+			for (size_t j = 0; j < logs[i].size(); j++) TT->store(logs[i][j].key,logs[i][j].e);
 		}
-		int maxval = _children[0]->evaluate();
-		for (size_t i = 1; i < _children.size(); i++) {
-			int val = _children[i]->evaluate();
-			if (val > maxval) maxval = val;
+	}
+	return _value;
+}
+// Minimax over the grown tree. Depth is set to the number of plies to the
+// nearest leaf, which is how deep the value is searched. Table entries are
+// added to the log.
+int Node::evaluate(int *depth, vector<TTStore> *log) {
+	*depth = 0;
+	if (!grown()) {
+		// A transposition may have been searched deeper than this leaf. Only
+		// exact values will do: alpha-beta also stores bounds.
+		TTEntry e;
+		if (TT && TT->probe(_pos.key(),&e) && e.bound == BoundExact) {
+			*depth = e.depth;
+			return _value = e.value;
 		}
-		_value = maxval;
-	} else {
-		if (_children.size() == 0) {
-			if (_pos.inCheck(black)) {
-				return _value = WhiteMate;
-			}
-			return Stalemate;
+		_value = intrinsicValue();
+		if (TT) {
+			e.value = _value;
+			e.depth = 0;
+			e.bound = BoundExact;
+			e.move = 0;
+			store(e,log);
 		}
-		int minval = _children[0]->evaluate();
-		for (size_t i = 1; i < _children.size(); i++) {
-			int val = _children[i]->evaluate();
-			if (val < minval) minval = val;
+		return _value;
+	}
+	if (_children.size() == 0) {
+		if (_pos.inCheck(_color)) {
+			return _value = _color == white ? BlackMate : WhiteMate;
 		}
-		_value = minval;
+		return _value = Stalemate;
+	}
+	int depths[MaxMoves];
+	for (size_t i = 0; i < _children.size(); i++) {
+		_children[i]->evaluate(&depths[i],log);
+	}
+	return bestOfChildren(depths,depth,log);
+}
+// Takes the best of the children's values, searched one ply deeper than the
+// shallowest of them
+int Node::bestOfChildren(const int *depths, int *depth, vector<TTStore> *log) {
+	int best = 0, mindepth = INT_MAX;
+	for (size_t i = 0; i < _children.size(); i++) {
+		int val = _children[i]->_value;
+		if (depths[i] < mindepth) mindepth = depths[i];
+		if (i == 0 || (_color == white ? val > _children[best]->_value : val < _children[best]->_value)) {
+			best = i;
+		}
+	}
+	_value = _children[best]->_value;
+	*depth = mindepth + 1;
+	if (TT) {
+		TTEntry e;
+		e.value = _value;
+		e.depth = *depth;
+		e.bound = BoundExact;
+		e.move = TTMove(_children[best]->_move.from(),_children[best]->_move.to());
+		store(e,log);
 	}
 	return _value;
 }
-int Node::value() const { return _value; }
-// Returns prediction weight for value
-float WeightForValue(int value) {
-	return expf((float)value/PredictionSpread);
+void Node::store(const TTEntry &e, vector<TTStore> *log) const {
+	TTStore s = { _pos.key(), e };
+	log->push_back(s);
+}
+// The subtrees ForkPlies below this node, and the leaves and ends of the game
+// above them, in depth-first order
+void Node::collectForks(int ply, vector<Node*> *forks) {
+	if (ply == ForkPlies || _children.size() == 0) {
+		forks->push_back(this);
+		return;
+	}
+	for (size_t i = 0; i < _children.size(); i++) {
+		_children[i]->collectForks(ply+1,forks);
+	}
+}
+// Minimax over the nodes above the forks, taking the depths of the forks in
+// the order they were collected
+void Node::evaluateAbove(int ply, const int *forkDepths, int *next, int *depth, vector<TTStore> *log) {
+	if (ply == ForkPlies || _children.size() == 0) {
+		*depth = forkDepths[(*next)++];
+		return;
+	}
+	int depths[MaxMoves];
+	for (size_t i = 0; i < _children.size(); i++) {
+		_children[i]->evaluateAbove(ply+1,forkDepths,next,&depths[i],log);
+	}
+	bestOfChildren(depths,depth,log);
 }
+int Node::value() const { return _value; }
 void Node::predict(float priority) {
 	_priority = priority;
 	if (_children.size() == 0) {
-		if (!grown()) {
-			AddTerminal(this);
-		}
+		_frontier = grown() ? 0 : 1;
 		return;
 	}
-	float weightsum = 0;
-	if (_color == white) {
-		// Sum prediction weights
-		for (size_t i = 0; i < _children.size(); i++) {
-			weightsum += WeightForValue(_children[i]->_value);
-		}
-		// Predict child nodes
-		for (size_t i = 0; i < _children.size(); i++) {
-			_children[i]->predict(WeightForValue(_children[i]->_value)/weightsum*_priority);
-		}
-	} else {
-		// Sum prediction weights
-		for (size_t i = 0; i < _children.size(); i++) {
-			weightsum += WeightForValue(-_children[i]->_value);
-		}
-		// Predict child nodes
-		for (size_t i = 0; i < _children.size(); i++) {
-			_children[i]->predict(WeightForValue(-_children[i]->_value)/weightsum*_priority);
-		}
+	predictChildren();
+	// Predict child nodes
+	for (size_t i = 0; i < _children.size(); i++) {
+		_children[i]->predict(_children[i]->_share*_priority);
+	}
+	updateFrontier();
+}
+// The shares and priorities are worked out down to the forks, which are then
+// predicted on the pool's threads, and the frontiers updated back up from them
+void Node::predict(float priority, ThreadPool *pool) {
+	vector<Node*> forks;
+	collectForks(0,&forks);
+	predictAbove(0,priority);
+	pool->run(forks.size(),[&](int i) {
+		forks[i]->predict(forks[i]->_priority);
+	});
+	updateFrontierAbove(0);
+}
+void Node::predictAbove(int ply, float priority) {
+	_priority = priority;
+	if (ply == ForkPlies || _children.size() == 0) return;
+	predictChildren();
+	for (size_t i = 0; i < _children.size(); i++) {
+		_children[i]->predictAbove(ply+1,_children[i]->_share*_priority);
+	}
+}
+void Node::updateFrontierAbove(int ply) {
+	if (ply == ForkPlies || _children.size() == 0) return;
+	for (size_t i = 0; i < _children.size(); i++) {
+		_children[i]->updateFrontierAbove(ply+1);
 	}
+	updateFrontier();
+}
+// Splits this node's priority between its children by their values, the
+// weights computed together from a contiguous copy of the values
+void Node::predictChildren() {
+	int num = _children.size();
+	float scale = (_color == white ? 1 : -1)/PredictionSpread;
+	float shares[MaxMoves];
+	for (int i = 0; i < num; i++) shares[i] = _children[i]->_value*scale;
+	Softmax(shares,num);
+	for (int i = 0; i < num; i++) _children[i]->_share = shares[i];
 }
 float Node::priority() const { return _priority; }
-/* void Node::heal() {
+void Node::heal() {
 	// This node has just had children calculated, and its value may have
-	// changed. Its parent's value may also have changed. Consequently, its
-	// probability estimate may also have changed. The game tree must be
-	// "healed".
+	// changed. Its parent's value may also have changed, and with it the
+	// shares of the parent's priority predicted for its children. The game
+	// tree is "healed" up to the first node whose value and frontier hold.
 	int val = _value;
 	evaluate();
-	if (!_parent) {
-		predict(_priority);
+	predictSubtree();
+	Node *node = this;
+	while (node->_parent) {
+		bool changed = node->_value != val;
+		node = node->_parent;
+		val = node->_value;
+		float frontier = node->_frontier;
+		if (changed) {
+			int best = node->_children[0]->_value;
+			for (size_t i = 1; i < node->_children.size(); i++) {
+				int v = node->_children[i]->_value;
+				if (node->_color == white ? v > best : v < best) best = v;
+			}
+			node->_value = best;
+			node->predictChildren();
+		}
+		node->updateFrontier();
+		if (node->_value == val && node->_frontier == frontier) break;
+	}
+}
+int Node::growBestFirst(size_t maxnodes, ThreadPool *pool, const function<void(float,size_t)> &grown) {
+	// Evaluate entire tree, then predict it if it is to grow. From then on
+	// the tree is healed as it grows.
+	evaluate(pool);
+	if (nodeCount < maxnodes) predict(1.0,pool);
+	while (nodeCount < maxnodes) {
+		Node *terms[MaxNumTerminals];
+		int numTerms = popFrontier(MaxNumTerminals,terms);
+		if (numTerms == 0) break;
+		// Grow the terminal nodes at once, each by its share of what was left
+		// before any of them grew, then heal the tree above each in turn. The
+		// tree comes out the same however many threads grow it.
+		size_t left = maxnodes - nodeCount;
+		size_t added[MaxNumTerminals];
+		pool->run(numTerms,[&](int i) {
+			added[i] = terms[i]->growWithin(terms[i]->priority()*left);
+		});
+		for (int i = 0; i < numTerms; i++) {
+			terms[i]->heal();
+			if (grown) grown(terms[i]->priority(),added[i]);
+		}
+	}
+	return _value;
+}
+void Node::predictSubtree() {
+	if (_children.size() == 0) {
+		_frontier = grown() ? 0 : 1;
 		return;
 	}
-	if (val == _value) { // Values healed
-		predict(_priority);
-	} else {
-		_parent->heal();
+	predictChildren();
+	for (size_t i = 0; i < _children.size(); i++) {
+		_children[i]->predictSubtree();
+	}
+	updateFrontier();
+}
+void Node::updateFrontier() {
+	_frontier = 0;
+	for (size_t i = 0; i < _children.size(); i++) {
+		float f = _children[i]->_share*_children[i]->_frontier;
+		if (f > _frontier) _frontier = f;
+	}
+}
+// Each leaf is found by following the child with the highest frontier
+// priority, and is then taken out of the frontier until it is grown
+int Node::popFrontier(int num, Node **leaves) {
+	int n = 0;
+	while (n < num && _frontier > 0) {
+		Node *node = this;
+		float priority = _priority;
+		while (node->grown()) {
+			Node *best = 0;
+			float frontier = 0;
+			for (size_t i = 0; i < node->_children.size(); i++) {
+				float f = node->_children[i]->_share*node->_children[i]->_frontier;
+				if (f > frontier) {
+					best = node->_children[i];
+					frontier = f;
+				}
+			}
+			priority *= best->_share;
+			node = best;
+		}
+		node->_priority = priority;
+		node->_frontier = 0;
+		leaves[n++] = node;
+		while (node != this) {
+			node = node->_parent;
+			node->updateFrontier();
+		}
 	}
-} */
+	return n;
+}
 int Node::numChildren() const {
 	return _children.size();
 }
@@ -347,16 +456,16 @@ const Node* Node::inheritor() const {
 	return inheritor->inheritor();
 }
 bool Node::whiteCanCastleKingside() const {
-	return !(_special & WhiteCanCastleKingsideMask) && !(_pos.squareForPiece(white_r2) & TakenMask);
+	return !(_pos._castling & WhiteCanCastleKingsideMask);
 }
 bool Node::whiteCanCastleQueenside() const {
-	return !(_special & WhiteCanCastleKingsideMask);
+	return !(_pos._castling & WhiteCanCastleQueensideMask);
 }
 bool Node::blackCanCastleKingside() const {
-	return !(_special & BlackCanCastleKingsideMask);
+	return !(_pos._castling & BlackCanCastleKingsideMask);
 }
 bool Node::blackCanCastleQueenside() const {
-	return !(_special & BlackCanCastleKingsideMask);
+	return !(_pos._castling & BlackCanCastleQueensideMask);
 }
 int Node::movesWithoutPawnMove() const {
 	return (_special & MovesWithoutPawnMoveMask) >> MovesWithoutPawnMoveShift;
@@ -370,25 +479,19 @@ int Node::terminationStatus() const {
 }
 Move Node::moveToNode(const Node *node) const {
 	if (!grown()) throw runtime_error("can only calculate moves from grown nodes");
-	vector<Move> moves;
-	Move move;
-	for (size_t i = 0; i < _children.size(); i++) {
-		if (_children[i] == node) {
-			move = _pos.moveToPositionForColor(node->_pos,_color);
-		} else {
-			moves.push_back(_pos.moveToPositionForColor(_children[i]->_pos,_color));
-		}
-	}
+	Move move = _pos.moveForPacked(node->_move);
+	if (move.special) return move;
+	// Give the origin file, or failing that the rank, only if another piece
+	// of the same kind could move to the same square
+	square from = node->_move.from();
 	bool savefile = 0, saverank = 0;
-	for (size_t i = 0; i < moves.size(); i++) {
-		if (moves[i].to == move.to &&
-			moves[i].piecechar == move.piecechar &&
-			moves[i].promotionchar == move.promotionchar) {
-			savefile = 1;
-			if (moves[i].file == move.file) saverank = 1;
-		}
+	for (size_t i = 0; i < _children.size(); i++) {
+		PackedMove m = _children[i]->_move;
+		if (m.castle() || m.to() != move.to || m.from() == from) continue;
+		if (PieceCharForIdx(_pos.pieceForSquareAndColor(m.from(),_color)) != (move.piecechar ? move.piecechar : pawn)) continue;
+		savefile = 1;
+		if (FileCharForSquare(m.from()) == move.file) saverank = 1;
 	}
-	if (move.piecechar == pawn) move.piecechar = 0;
 	if (!savefile) {
 		move.file = 0;
 		move.rank = 0;
@@ -404,6 +507,9 @@ const Node* Node::onlyChild() const {
 	if (_children.size() != 1) throw runtime_error("number of children not 1");
 	return _children[0];
 }
+Node* Node::child(int i) {
+	return _children[i];
+}
 const Position& Node::pos() const {
 	return _pos;
 }
@@ -414,6 +520,14 @@ void Node::deleteChildrenExcept(Node *inheritor) {
 	_children.clear();
 	_children.push_back(inheritor);
 }
+void Node::prune() {
+	for (size_t i = 0; i < _children.size(); i++) {
+		delete _children[i];
+	}
+	nodeCount -= _children.size();
+	_children.clear();
+	_special &= ~GrownMask;
+}
 void Node::printGame(ostream &out,std::list<Move> &moves) const {
 	const Node *node = this;
 	while (node->_parent) node = node->_parent;
@@ -463,326 +577,23 @@ void Node::printGame(ostream &out,std::list<Move> &moves) const {
 int Node::intrinsicValue() const {
 	return _pos.value();
 }
-void Node::pawnMoves(square ps, square *squares) {
-	int i = 0;
-	square cs;
-	if (_color == white) {
-		cs = SquareAbove(ps);
-		if (_pos.squareColor(cs) == emptycolor) {
-			squares[i++] = cs;
-			if (RankIdxForSquare(ps) == 1) {
-				// Double-step from starting rank
-				cs = SquareAbove(cs);
-				if (_pos.squareColor(cs) == emptycolor) squares[i++] = cs;
-			}
-		}
-		// Captures
-		if (HasSquareAboveRight(ps)) {
-			cs = SquareAboveRight(ps);
-			if (_pos.squareColor(cs) == OppositeColor(_color)) squares[i++] = cs | TakesMask;
-		}
-		if (HasSquareAboveLeft(ps)) {
-			cs = SquareAboveLeft(ps);
-			if (_pos.squareColor(cs) == OppositeColor(_color)) squares[i++] = cs | TakesMask;
-		}
-	} else { // Black
-		cs = SquareBelow(ps);
-		if (_pos.squareColor(cs) == emptycolor) {
-			squares[i++] = cs;
-			if (RankIdxForSquare(ps) == 6) {
-				// Double-step from starting rank
-				cs = SquareBelow(cs);
-				if (_pos.squareColor(cs) == emptycolor) squares[i++] = cs;
-			}
-		}
-		// Captures
-		if (HasSquareBelowRight(ps)) {
-			cs = SquareBelowRight(ps);
-			if (_pos.squareColor(cs) == OppositeColor(_color)) squares[i++] = cs | TakesMask;
-		}
-		if (HasSquareBelowLeft(ps)) {
-			cs = SquareBelowLeft(ps);
-			if (_pos.squareColor(cs) == OppositeColor(_color)) squares[i++] = cs | TakesMask;
-		}
-	}
-	squares[i++] = nosquare;
-}
-void Node::rookMoves(square rs, square *squares) {
-	int i = 0;
-	square cs; // Current square
-	if (HasSquareAbove(rs)) { // Move up
-		cs = SquareAbove(rs);
-		while (1) {
-			color c = _pos.squareColor(cs);
-			if (c == emptycolor) {
-				squares[i++] = cs;
-				if (!HasSquareAbove(cs)) break;
-				cs = SquareAbove(cs);
-			} else if (c != _color) { // Take piece
-				squares[i++] = cs | TakesMask;
-				break;
-			} else break;
-		}
-	}
-	if (HasSquareBelow(rs)) { // Move up
-		cs = SquareBelow(rs);
-		while (1) {
-			color c = _pos.squareColor(cs);
-			if (c == emptycolor) {
-				squares[i++] = cs;
-				if (!HasSquareBelow(cs)) break;
-				cs = SquareBelow(cs);
-			} else if (c != _color) { // Take piece
-				squares[i++] = cs | TakesMask;
-				break;
-			} else break;
-		}
-	}
-	if (HasSquareRight(rs)) { // Move right
-		cs = SquareRight(rs);
-		while (1) {
-			color c = _pos.squareColor(cs);
-			if (c == emptycolor) {
-				squares[i++] = cs;
-				if (!HasSquareRight(cs)) break;
-				cs = SquareRight(cs);
-			} else if (c != _color) { // Take piece
-				squares[i++] = cs | TakesMask;
-				break;
-			} else break;
-		}
-	}
-	if (HasSquareLeft(rs)) { // Move left
-		cs = SquareLeft(rs);
-		while (1) {
-			color c = _pos.squareColor(cs);
-			if (c == emptycolor) {
-				squares[i++] = cs;
-				if (!HasSquareLeft(cs)) break;
-				cs = SquareLeft(cs);
-			} else if (c != _color) { // Take piece
-				squares[i++] = cs | TakesMask;
-				break;
-			} else break;
-		}
-	}
-	squares[i++] = nosquare;
-}
-void Node::knightMoves(square ns, square *squares) {
-	int i = 0;
-	square cs;
-	color c;
-	if (HasSquareUUR(ns)) {
-		cs = SquareUUR(ns);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) squares[i++] = cs;
-		else if (c != _color) squares[i++] = cs | TakesMask;
-	}
-	if (HasSquareUUL(ns)) {
-		cs = SquareUUL(ns);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) squares[i++] = cs;
-		else if (c != _color) squares[i++] = cs | TakesMask;
-	}
-	if (HasSquareRRU(ns)) {
-		cs = SquareRRU(ns);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) squares[i++] = cs;
-		else if (c != _color) squares[i++] = cs | TakesMask;
-	}
-	if (HasSquareRRD(ns)) {
-		cs = SquareRRD(ns);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) squares[i++] = cs;
-		else if (c != _color) squares[i++] = cs | TakesMask;
-	}
-	if (HasSquareLLU(ns)) {
-		cs = SquareLLU(ns);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) squares[i++] = cs;
-		else if (c != _color) squares[i++] = cs | TakesMask;
-	}
-	if (HasSquareLLD(ns)) {
-		cs = SquareLLD(ns);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) squares[i++] = cs;
-		else if (c != _color) squares[i++] = cs | TakesMask;
-	}
-	if (HasSquareDDR(ns)) {
-		cs = SquareDDR(ns);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) squares[i++] = cs;
-		else if (c != _color) squares[i++] = cs | TakesMask;
-	}
-	if (HasSquareDDL(ns)) {
-		cs = SquareDDL(ns);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) squares[i++] = cs;
-		else if (c != _color) squares[i++] = cs | TakesMask;
-	}
-	squares[i++] = nosquare;
-}
-void Node::bishopMoves(square bs, square *squares) {
-	int i = 0;
-	square cs; // Current square
-	if (HasSquareAboveRight(bs)) { // Move up and to the right
-		cs = SquareAboveRight(bs);
-		while (1) {
-			color c = _pos.squareColor(cs);
-			if (c == emptycolor) {
-				squares[i++] = cs;
-				if (!HasSquareAboveRight(cs)) break;
-				cs = SquareAboveRight(cs);
-			} else if (c != _color) { // Take piece
-				squares[i++] = cs | TakesMask;
-				break;
-			} else break;
-		}
-	}
-	if (HasSquareAboveLeft(bs)) { // Move up and to the left
-		cs = SquareAboveLeft(bs);
-		while (1) {
-			color c = _pos.squareColor(cs);
-			if (c == emptycolor) {
-				squares[i++] = cs;
-				if (!HasSquareAboveLeft(cs)) break;
-				cs = SquareAboveLeft(cs);
-			} else if (c != _color) { // Take piece
-				squares[i++] = cs | TakesMask;
-				break;
-			} else break;
-		}
-	}
-	if (HasSquareBelowRight(bs)) { // Move down and to the right
-		cs = SquareBelowRight(bs);
-		while (1) {
-			color c = _pos.squareColor(cs);
-			if (c == emptycolor) {
-				squares[i++] = cs;
-				if (!HasSquareBelowRight(cs)) break;
-				cs = SquareBelowRight(cs);
-			} else if (c != _color) { // Take piece
-				squares[i++] = cs | TakesMask;
-				break;
-			} else break;
-		}
-	}
-	if (HasSquareBelowLeft(bs)) { // Move down and to the left
-		cs = SquareBelowLeft(bs);
-		while (1) {
-			color c = _pos.squareColor(cs);
-			if (c == emptycolor) {
-				squares[i++] = cs;
-				if (!HasSquareBelowLeft(cs)) break;
-				cs = SquareBelowLeft(cs);
-			} else if (c != _color) { // Take piece
-				squares[i++] = cs | TakesMask;
-				break;
-			} else break;
-		}
-	}
-	squares[i++] = nosquare;
-}
-void Node::queenMoves(square qs, square *squares) {
-	rookMoves(qs,squares);
-	for (; *squares != nosquare; squares++);
-	bishopMoves(qs,squares);
-}
-void Node::kingMoves(square ks, square *squares) {
-	int i = 0;
-	square cs;
-	color c;
-	// NOTE: could make more efficient
-	if (HasSquareAboveRight(ks)) {
-		cs = SquareAboveRight(ks);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) {
-			squares[i++] = cs;
-		} else if (c != _color) {
-			squares[i++] = cs | TakesMask;
-		}
-	}
-	if (HasSquareRight(ks)) {
-		cs = SquareRight(ks);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) {
-			squares[i++] = cs;
-		} else if (c != _color) {
-			squares[i++] = cs | TakesMask;
-		}
-	}
-	if (HasSquareBelowRight(ks)) {
-		cs = SquareBelowRight(ks);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) {
-			squares[i++] = cs;
-		} else if (c != _color) {
-			squares[i++] = cs | TakesMask;
-		}
-	}
-	if (HasSquareBelow(ks)) {
-		cs = SquareBelow(ks);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) {
-			squares[i++] = cs;
-		} else if (c != _color) {
-			squares[i++] = cs | TakesMask;
-		}
-	}
-	if (HasSquareBelowLeft(ks)) {
-		cs = SquareBelowLeft(ks);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) {
-			squares[i++] = cs;
-		} else if (c != _color) {
-			squares[i++] = cs | TakesMask;
-		}
-	}
-	if (HasSquareLeft(ks)) {
-		cs = SquareLeft(ks);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) {
-			squares[i++] = cs;
-		} else if (c != _color) {
-			squares[i++] = cs | TakesMask;
-		}
-	}
-	if (HasSquareAboveLeft(ks)) {
-		cs = SquareAboveLeft(ks);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) {
-			squares[i++] = cs;
-		} else if (c != _color) {
-			squares[i++] = cs | TakesMask;
-		}
-	}
-	if (HasSquareAbove(ks)) {
-		cs = SquareAbove(ks);
-		c = _pos.squareColor(cs);
-		if (c == emptycolor) {
-			squares[i++] = cs;
-		} else if (c != _color) {
-			squares[i++] = cs | TakesMask;
-		}
-	}
-	squares[i++] = nosquare;
-}
 Node* Node::applyMove(Move m) {
 	if (!grown()) {
 		throw runtime_error("must move in grown node");
 	}
-	// Find the child(ren) compatible with the given move
-	vector<Node*> compats;
-	compats.reserve(3);
+	// Find the child compatible with the given move
+	MoveList moves;
 	for (size_t i = 0; i < _children.size(); i++) {
-		if (moveCompatible(m,_children[i]->_pos)) compats.push_back(_children[i]);
+		moves.push(_children[i]->_move);
 	}
-	if (compats.size() == 0) throw IllegalMove();
-	if (compats.size() > 1) throw AmbiguousMove();
-	Node *inheritor = compats[0];
-	// Delete the other children
-	//deleteChildrenExcept(inheritor);
-	return inheritor;
+	PackedMove match;
+	int num = _pos.movesMatching(m,moves,&match);
+	if (num == 0) throw IllegalMove();
+	if (num > 1) throw AmbiguousMove();
+	for (size_t i = 0; i < _children.size(); i++) {
+		if (_children[i]->_move == match) return _children[i];
+	}
+	throw IllegalMove();
 }
 Node* Node::playFor(color c, Move *move) {
 	if (_children.size() == 0) {
@@ -804,6 +615,18 @@ Node* Node::playFor(color c, Move *move) {
 	deleteChildrenExcept(inheritor);
 	return inheritor;
 }
+Node* Node::playMove(PackedMove pm, Move *move) {
+	grow(1);
+	for (size_t i = 0; i < _children.size(); i++) {
+		Node *inheritor = _children[i];
+		if (inheritor->_move == pm) {
+			*move = moveToNode(inheritor);
+			deleteChildrenExcept(inheritor);
+			return inheritor;
+		}
+	}
+	throw IllegalMove();
+}
 ostream& operator<<(ostream &out, const Node &n) {
 	out << n._pos;
 	return out;
@@ -827,51 +650,6 @@ void Node::printWithChildren(ostream &out, int depth) const {
 	}
 	out << '\n';
 }
-bool Node::moveCompatible(Move m, const Position &pos) {
-	// Given that the given position is the result of a legal move from this
-	// node's position, determine whether the given move (which may or may not
-	// be legal) describes the change.
-	
-	// Castling
-	if (m.special & smCastleKingside) {
-		piece kp = _color == white ? white_k : black_k;
-		piece rp = _color == white ? white_r2 : black_r2;
-		return pos.squareForPiece(kp) != _pos.squareForPiece(kp) &&
-			pos.squareForPiece(rp) != _pos.squareForPiece(rp);
-	}
-	if (m.special & smCastleQueenside) {
-		piece kp = _color == white ? white_k : black_k;
-		piece rp = _color == white ? white_r1 : black_r1;
-		return pos.squareForPiece(kp) != _pos.squareForPiece(kp) &&
-			pos.squareForPiece(rp) != _pos.squareForPiece(rp);
-	}
-	// If this is marked as a capture, a piece of the opposite color must have
-	// been captured.
-	if (m.takes &&
-			_pos.numForColor(OppositeColor(_color)) !=
-			pos.numForColor(OppositeColor(_color)) + 1) {
-		return false;
-	}
-	// If a file is given, a piece of the current color must have moved from that file.
-	if (m.file && _pos.numForColorInFile(_color,m.file) != pos.numForColorInFile(_color,m.file) + 1) return false;
-	// If a file and rank are given, a piece of the current color must have moved from that square.
-	if (m.file && m.rank) {
-		square s = SquareWithFileAndRankChars(m.file,m.rank);
-		if (_pos.squareColor(s) != _color || pos.squareColor(s) == _color) return false;
-	}
-	// Not moving is not moving
-	piece p = pos.pieceForSquareAndColor(m.to,_color);
-	if (_pos.pieceForSquareAndColor(m.to,_color) == p) return false;
-	// Promotion
-	if (m.promotionchar) {
-		int before = _pos.numForPieceChar(m.promotionchar,_color);
-		int after = pos.numForPieceChar(m.promotionchar,_color);
-		return after == before + 1 && PieceCharForIdx(pos.pieceForSquareAndColor(m.to,_color)) == m.promotionchar;
-	}
-	// You must have moved the right piece
-	if (m.piecechar != PieceCharForIdx(p)) return false;
-	return true;
-}
 Node::SpecialType Node::nextSpecialWithMovesWithoutPawnMove(int moves) {
 	return (_special & ~(MovesWithoutPawnMoveMask|GrownMask)) | ((moves << MovesWithoutPawnMoveShift) & MovesWithoutPawnMoveMask);
 }
@@ -879,38 +657,3 @@ Node::SpecialType Node::nextSpecial() {
 	return nextSpecialWithMovesWithoutPawnMove(movesWithoutPawnMove()+1);
 }
 
-Node* terms[MaxNumTerminals+2];
-int numTerms = 0;
-void AddTerminal(Node *term) {
-	// Insert new element
-	terms[++numTerms] = term;
-	int i = numTerms/2; // parent
-	int j = numTerms; // child
-	while (i != j && i > 0) {
-		if (terms[i]->priority() > terms[j]->priority()) {
-			Node *temp = terms[i];
-			terms[i] = terms[j];
-			terms[j] = temp;
-		}
-		j = i;
-		i /= 2;
-	}
-	if (numTerms > MaxNumTerminals) {
-		terms[1] = terms[MaxNumTerminals];
-		int i = 1;
-		int j = 2;
-		while (j < MaxNumTerminals) {
-			if (terms[i]->priority() > terms[j]->priority()) {
-				if (terms[j]->priority() > terms[j+1]->priority()) {
-					j = j + 1;
-				}
-				Node *temp = terms[i];
-				terms[i] = terms[j];
-				terms[j] = temp;
-			}
-			i = j;
-			j *= 2;
-		}
-		numTerms--;
-	}
-}
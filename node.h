@@ -11,9 +11,11 @@
 #include "move.h"
 
 #include <atomic>
+#include <functional>
 #include <iostream>
 #include <stdexcept>
 #include <list>
+#include <vector>
 
 using namespace std;
 
@@ -31,20 +33,48 @@ public:
 };
 
 struct Move;
+struct TTEntry;
+struct TTStore; // Table entry to be stored later
+class ThreadPool;
 
 class Node {
 public:
 	Node(int depth); // Initial node
+	Node(const Position&, color turn, int depth, int movesWithoutPawnMove);
 	~Node();
 	const Node *parent() const;
-	void grow(int depth);
+	PackedMove move() const; // From the parent, NoMove for the root
+	// Nodes are allocated from memory held by the thread that allocates them
+	static void *operator new(size_t);
+	static void operator delete(void*);
+	size_t grow(int depth); // Returns the number of nodes added
+	// Grows at least one ply, and more while the estimated size of the next
+	// ply stays within the number of nodes given. Returns the number of nodes
+	// added.
+	size_t growWithin(size_t nodes);
 	bool grown() const;
 	int evaluate();
+	// Splits the subtrees ForkPlies below between the pool's threads. The
+	// transposition table is only updated once they are all evaluated, here
+	// as without the pool, which makes the values the same however many
+	// threads there are.
+	int evaluate(ThreadPool*);
 	int value() const;
 	int intrinsicValue() const;
 	void predict(float priority);
+	void predict(float priority, ThreadPool*); // Same as without the pool
 	float priority() const;
-	void heal();
+	void heal(); // Updates values and predictions after growing the node
+	// Evaluates and predicts the tree, then grows it until it holds maxnodes
+	// nodes: the unexplored leaves of highest priority are grown at once on
+	// the pool's threads, each by its share of the nodes left, and the tree is
+	// healed above them. Grown, if given, gets the priority of each leaf and
+	// the number of nodes grown below it. Returns the value of the node.
+	int growBestFirst(size_t maxnodes, ThreadPool*, const function<void(float,size_t)> &grown = 0);
+	// Takes up to num unexplored leaves of highest priority out of the
+	// frontier below this node, which they rejoin as they are grown and healed.
+	// Returns the number taken.
+	int popFrontier(int num, Node **leaves);
 	int numChildren() const;
 	color getColor() const;
 	const Node *inheritor() const;
@@ -57,48 +87,59 @@ public:
 	Move moveToNode(const Node*) const;
 	Move moveToOnlyChild() const;
 	const Node *onlyChild() const;
+	Node *child(int);
 	const Position& pos() const;
 	Node* applyMove(Move);
 	Node *playFor(color, Move*);
+	Node *playMove(PackedMove, Move*); // Grows the node if needed
 	friend ostream& operator<<(ostream&,const Node&);
 	void printWithChildren(ostream&,int depth) const;
 	void deleteChildrenExcept(Node*);
+	void prune(); // Deletes all children, leaving the node ungrown
 	void printGame(ostream&,std::list<Move>&) const;
 private:
 	typedef u16 SpecialType;
 	Node(Node *parent, const Position& p, color turn, int depth,SpecialType);
-	void addPosition(const Position&,int depth,SpecialType);
-	void addAllMoves(piece,square*,int depth,SpecialType);
-	void pawnMoves(square,square*);
-	void rookMoves(square,square*);
-	void knightMoves(square,square*);
-	void bishopMoves(square,square*);
-	void queenMoves(square,square*);
-	void kingMoves(square,square*);
-	void movesForPiece(piece,square*);
-	bool moveCompatible(Move m,const Position&);
+	void addChild(PackedMove,SpecialType);
+	int evaluate(int *depth, vector<TTStore> *log);
+	int bestOfChildren(const int *depths, int *depth, vector<TTStore> *log);
+	void store(const TTEntry&, vector<TTStore> *log) const;
+	void collectForks(int ply, vector<Node*> *forks);
+	void evaluateAbove(int ply, const int *forkDepths, int *next, int *depth, vector<TTStore> *log);
+	void predictAbove(int ply, float priority);
+	void updateFrontierAbove(int ply);
+	void predictChildren();
+	void predictSubtree(); // Shares only
+	void updateFrontier(); // From the children's
 	int _value;
 	Node *_parent;
 	Position _pos;
 	vector<Node*> _children;
 	float _priority;
+	float _share; // Of the parent's priority
+	// Highest priority of an unexplored leaf below, relative to this node's:
+	// 1 for an unexplored leaf itself, 0 if there is none
+	float _frontier;
 	SpecialType _special;
 	SpecialType nextSpecialWithMovesWithoutPawnMove(int);
 	SpecialType nextSpecial();
 #define GrownMask 0x10
-#define WhiteCanCastleKingsideMask 0x01
-#define WhiteCanCastleQueensideMask 0x02
-#define BlackCanCastleKingsideMask 0x04
-#define BlackCanCastleQueensideMask 0x08
 #define MovesWithoutPawnMoveMask 0x7e0
 #define MovesWithoutPawnMoveShift 5
+	PackedMove _move;
 	color _color;
+	friend class Cluster;
+	// Monte-Carlo tree search statistics
+	friend class MCTS;
+	atomic<u32> _visits; // Including playouts still in progress
+	atomic<int64_t> _valueSum; // For the side that moved here, in MCTSUnits
+	atomic<u8> _expansion;
+#define MCTSNotExpanded 0
+#define MCTSExpanding 1 // By one thread, which the others treat as a leaf
+#define MCTSExpanded 2 // Children have values and shares
 };
 ostream& operator<<(ostream&,const Node&);
 
 extern atomic_size_t nodeCount;
-extern Node* terms[MaxNumTerminals+2];
-extern int numTerms;
-void AddTerminal(Node*);
 
 #endif // node_h
@@ -0,0 +1,104 @@
+//
+// perft.cpp
+//
+
+#include "perft.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+
+using namespace std;
+using namespace std::chrono;
+
+//
+// PerftCache
+//
+PerftCache::PerftCache(size_t megabytes) : _entries(0), _mask(0) {
+	size_t num = 1;
+	while (2*num*sizeof(Entry) <= megabytes << 20) num *= 2;
+	_entries = new Entry[num]();
+	_mask = num - 1;
+}
+PerftCache::~PerftCache() {
+	delete[] _entries;
+}
+bool PerftCache::probe(u64 key, int depth, u64 *count) const {
+	const Entry &e = _entries[key & _mask];
+	u64 data = e.data.load(memory_order_relaxed);
+	u64 check = e.check.load(memory_order_relaxed);
+	if ((check ^ data) != key || (int)(data & 0xff) != depth) return false;
+	*count = data >> 8;
+	return true;
+}
+void PerftCache::store(u64 key, int depth, u64 count) {
+	Entry &e = _entries[key & _mask];
+	u64 data = (count << 8) | depth;
+	e.check.store(key ^ data,memory_order_relaxed);
+	e.data.store(data,memory_order_relaxed);
+}
+
+//
+// perft
+//
+static u64 PerftKey(const Node *node, int depth) {
+	u64 key = node->pos().key();
+	// The move counter only matters when it can reach its limit within depth
+	int moves = node->movesWithoutPawnMove();
+	if (moves + depth > MaxMovesWithoutPawnMove) key ^= (u64)(moves + 1) * 0x9e3779b97f4a7c15ull;
+	return key;
+}
+u64 Perft(Node *node, int depth, PerftCache *cache) {
+	if (depth == 0) return 1;
+	u64 key = 0, count = 0;
+	if (cache && depth > 1) {
+		key = PerftKey(node,depth);
+		if (cache->probe(key,depth,&count)) return count;
+	}
+	node->grow(1);
+	if (depth == 1) {
+		count = node->numChildren();
+	} else {
+		for (int i = 0; i < node->numChildren(); i++) {
+			count += Perft(node->child(i),depth-1,cache);
+		}
+	}
+	node->prune();
+	if (cache && depth > 1) cache->store(key,depth,count);
+	return count;
+}
+
+u64 RunPerft(Node *root, int depth, int threads, size_t cachemegabytes, bool divide, ostream &out) {
+	if (depth < 1) throw runtime_error("perft depth must be at least 1");
+	if (threads < 1) threads = 1;
+	PerftCache *cache = cachemegabytes ? new PerftCache(cachemegabytes) : 0;
+	steady_clock::time_point start = steady_clock::now();
+	root->grow(1);
+	int num = root->numChildren();
+	vector<u64> counts(num);
+	// Threads take root moves in turn until there are none left
+	atomic<int> next(0);
+	auto work = [&]() {
+		for (int i = next++; i < num; i = next++) {
+			counts[i] = Perft(root->child(i),depth-1,cache);
+		}
+	};
+	vector<thread> pool;
+	for (int t = 1; t < threads; t++) pool.push_back(thread(work));
+	work();
+	for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+	double secs = duration<double>(steady_clock::now() - start).count();
+	u64 total = 0;
+	for (int i = 0; i < num; i++) {
+		if (divide) out << root->moveToNode(root->child(i)) << ": " << counts[i] << '\n';
+		total += counts[i];
+	}
+	root->prune();
+	delete cache;
+	if (divide) out << '\n';
+	out << "perft " << depth << ": " << total << " nodes in " << secs << " s, "
+		<< (secs > 0 ? (u64)(total/secs) : 0) << " nodes/s\n";
+	return total;
+}
@@ -0,0 +1,46 @@
+//
+// perft.h
+// Move generation path counts
+//
+
+#ifndef perft_h
+#define perft_h
+
+#include <atomic>
+#include <iostream>
+
+#include "board.h"
+#include "node.h"
+
+using namespace std;
+
+//
+// PerftCache
+//
+// Leaf counts of subtrees already visited, shared between threads without
+// locks. Each entry stores its key XORed with its data, so an entry torn by a
+// concurrent store fails to match and is treated as a miss.
+//
+class PerftCache {
+public:
+	PerftCache(size_t megabytes);
+	~PerftCache();
+	bool probe(u64 key, int depth, u64 *count) const;
+	void store(u64 key, int depth, u64 count);
+private:
+	struct Entry {
+		atomic<u64> check; // key ^ data
+		atomic<u64> data; // Leaf count in the high bits, depth in the low 8
+	};
+	Entry *_entries;
+	size_t _mask;
+};
+
+// Number of leaves depth plies below the node. The node is left ungrown.
+u64 Perft(Node*, int depth, PerftCache*);
+// Runs perft from the node, splitting the root moves between threads, and
+// reports the leaf count and speed. Divide also prints the count below each
+// root move. Returns the leaf count.
+u64 RunPerft(Node*, int depth, int threads, size_t cachemegabytes, bool divide, ostream&);
+
+#endif // perft_h
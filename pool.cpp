@@ -0,0 +1,100 @@
+//
+// pool.cpp
+//
+
+#include "pool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threads) :
+		_size(threads < 1 ? 1 : threads), _queues(new Queue[_size]), _task(0),
+		_batch(0), _pending(0), _quit(false) {
+	for (int t = 1; t < _size; t++) {
+		_threads.push_back(thread([this,t]() {
+			unsigned batch = 0;
+			while (1) {
+				{
+					unique_lock<mutex> lock(_lock);
+					_started.wait(lock,[&]() { return _quit || _batch != batch; });
+					if (_quit) return;
+					batch = _batch;
+				}
+				work(t);
+			}
+		}));
+	}
+}
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> lock(_lock);
+		_quit = true;
+	}
+	_started.notify_all();
+	for (size_t t = 0; t < _threads.size(); t++) _threads[t].join();
+	delete[] _queues;
+}
+int ThreadPool::size() const { return _size; }
+void ThreadPool::run(int num, const function<void(int)> &task) {
+	if (num <= 0) return;
+	if (_size == 1) {
+		for (int i = 0; i < num; i++) task(i);
+		return;
+	}
+	// The task is set before any of its indices can be taken
+	{
+		lock_guard<mutex> lock(_lock);
+		_task = &task;
+		_pending = num;
+	}
+	for (int i = 0; i < num; i++) {
+		Queue &q = _queues[i % _size];
+		lock_guard<mutex> lock(q.lock);
+		q.tasks.push_back(i);
+	}
+	{
+		lock_guard<mutex> lock(_lock);
+		_batch++;
+	}
+	_started.notify_all();
+	work(0);
+	unique_lock<mutex> lock(_lock);
+	_finished.wait(lock,[&]() { return _pending == 0; });
+	_task = 0;
+}
+// Runs tasks until there are none left to take. A thread that wakes late
+// finds the queues empty, or already filled with the next batch's tasks,
+// which it then helps with.
+void ThreadPool::work(int worker) {
+	int i;
+	while (take(worker,&i)) {
+		const function<void(int)> *task;
+		{
+			lock_guard<mutex> lock(_lock);
+			task = _task;
+		}
+		(*task)(i);
+		lock_guard<mutex> lock(_lock);
+		if (--_pending == 0) _finished.notify_one();
+	}
+}
+bool ThreadPool::take(int worker, int *task) {
+	{
+		Queue &q = _queues[worker];
+		lock_guard<mutex> lock(q.lock);
+		if (!q.tasks.empty()) {
+			*task = q.tasks.front();
+			q.tasks.pop_front();
+			return true;
+		}
+	}
+	for (int v = 1; v < _size; v++) {
+		Queue &q = _queues[(worker + v) % _size];
+		lock_guard<mutex> lock(q.lock);
+		if (!q.tasks.empty()) {
+			*task = q.tasks.back();
+			q.tasks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,52 @@
+//
+// pool.h
+// Work-stealing thread pool
+//
+
+#ifndef pool_h
+#define pool_h
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//
+// ThreadPool
+//
+// Runs batches of tasks on a fixed number of threads, the calling thread
+// among them. The tasks of a batch are dealt out to the threads in turn; each
+// thread runs its own from the front, and when it runs out takes the last
+// ones of the others.
+//
+class ThreadPool {
+public:
+	ThreadPool(int threads); // Including the calling thread
+	~ThreadPool();
+	int size() const;
+	// Runs task(i) for i from 0 to num-1, returning when all have finished.
+	// With a single thread they run in order on the calling thread.
+	void run(int num, const function<void(int)> &task);
+private:
+	struct Queue {
+		mutex lock;
+		deque<int> tasks;
+	};
+	void work(int worker);
+	bool take(int worker, int *task);
+	int _size;
+	Queue *_queues;
+	vector<thread> _threads;
+	mutex _lock;
+	condition_variable _started, _finished;
+	const function<void(int)> *_task;
+	unsigned _batch; // Counts the batches run
+	int _pending; // Tasks of the batch not yet finished
+	bool _quit;
+};
+
+#endif // pool_h
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdexcept>
 #include <sstream>
+#include <cctype>
 
 #include "config.h"
 
@@ -54,18 +55,169 @@ Position Position::initialPosition() {
 	p._positions[black_k] = 59;
 	p._boardmasks[black] = 0xffff000000000000;
 	p._promotions = 0;
+	p._castling = 0;
+	for (square s = 0; s < 64; s++) p._board[s] = nopiece;
+	for (piece i = 0; i < 32; i++) p._board[p._positions[i]] = i;
+	p.setPieceMasks();
+	p._key = p.computeKey();
 	return p;
 }
+Position Position::fromFEN(const string &fen, color *turn, int *halfmoves) {
+	Position p;
+	for (piece i = 0; i < 32; i++) p._positions[i] = TakenMask; // Not on the board
+	for (square s = 0; s < 64; s++) p._board[s] = nopiece;
+	p._boardmasks[white] = p._boardmasks[black] = 0;
+	p._promotions = 0;
+	p._castling = 0;
+	p._key = 0;
+	stringstream ss(fen);
+	string board, side, castling, enpassant;
+	*halfmoves = 0;
+	ss >> board >> side >> castling >> enpassant >> *halfmoves;
+	// Piece placement, from a8 to h1
+	char pieces[64] = { 0 };
+	char file = 'a', rank = '8';
+	for (size_t i = 0; i < board.length(); i++) {
+		char c = board[i];
+		if (c == '/') {
+			if (file != 'i' || rank == '1') throw runtime_error("bad FEN rank");
+			rank--;
+			file = 'a';
+		} else if (c >= '1' && c <= '8') {
+			file += c - '0';
+			if (file > 'i') throw runtime_error("bad FEN rank");
+		} else {
+			if (!IsFileChar(file)) throw runtime_error("bad FEN rank");
+			pieces[SquareWithFileAndRankChars(file,rank)] = c;
+			file++;
+		}
+	}
+	if (file != 'i' || rank != '1') throw runtime_error("bad FEN board");
+	// Rooks in their corners go first so that they get the pieces castling
+	// expects there
+	static const square corners[4] = { sq_a1, sq_h1, sq_a8, sq_h8 };
+	for (int i = 0; i < 4; i++) {
+		char c = pieces[corners[i]];
+		if (c == 'R' || c == 'r') {
+			p.placePiece(rook,c == 'R' ? white : black,corners[i]);
+			pieces[corners[i]] = 0;
+		}
+	}
+	for (square s = 0; s < 64; s++) {
+		char c = pieces[s];
+		if (c == 0) continue;
+		char pc = toupper(c) == 'P' ? pawn : toupper(c);
+		if (!IsPieceChar(pc)) throw runtime_error("bad FEN piece");
+		p.placePiece(pc,isupper(c) ? white : black,s);
+	}
+	if (p._positions[white_k] & TakenMask || p._positions[black_k] & TakenMask) {
+		throw runtime_error("FEN lacks a king");
+	}
+	if (side == "w") *turn = white;
+	else if (side == "b") *turn = black;
+	else throw runtime_error("bad FEN side to move");
+	// Castling rights, kept only where the king and rook are in place
+	p._castling = WhiteCanCastleKingsideMask | WhiteCanCastleQueensideMask |
+		BlackCanCastleKingsideMask | BlackCanCastleQueensideMask;
+	for (size_t i = 0; castling != "-" && i < castling.length(); i++) {
+		switch (castling[i]) {
+		case 'K': p._castling &= ~WhiteCanCastleKingsideMask; break;
+		case 'Q': p._castling &= ~WhiteCanCastleQueensideMask; break;
+		case 'k': p._castling &= ~BlackCanCastleKingsideMask; break;
+		case 'q': p._castling &= ~BlackCanCastleQueensideMask; break;
+		default: throw runtime_error("bad FEN castling rights");
+		}
+	}
+	if (p._board[sq_e1] != white_k) p._castling |= WhiteCanCastleKingsideMask | WhiteCanCastleQueensideMask;
+	if (p._board[sq_h1] != white_r2) p._castling |= WhiteCanCastleKingsideMask;
+	if (p._board[sq_a1] != white_r1) p._castling |= WhiteCanCastleQueensideMask;
+	if (p._board[sq_e8] != black_k) p._castling |= BlackCanCastleKingsideMask | BlackCanCastleQueensideMask;
+	if (p._board[sq_h8] != black_r2) p._castling |= BlackCanCastleKingsideMask;
+	if (p._board[sq_a8] != black_r1) p._castling |= BlackCanCastleQueensideMask;
+	p.setPieceMasks();
+	// Otherwise the king could be taken
+	if (p.inCheck(OppositeColor(*turn))) throw runtime_error("FEN side not to move is in check");
+	p._key = p.computeKey();
+	if (*turn == black) p._key ^= ZobristBlackToMove;
+	return p;
+}
+string Position::toFEN(color turn, int halfmoves) const {
+	static const char kindChars[NumKinds+1] = "PRNBQK";
+	stringstream ss;
+	for (char rank = '8'; rank >= '1'; rank--) {
+		int empty = 0;
+		for (char file = 'a'; file <= 'h'; file++) {
+			piece p = _board[SquareWithFileAndRankChars(file,rank)];
+			if (p == nopiece) {
+				empty++;
+				continue;
+			}
+			if (empty) ss << empty;
+			empty = 0;
+			char c = kindChars[pieceKind(p)];
+			ss << (p >= 16 ? (char)tolower(c) : c);
+		}
+		if (empty) ss << empty;
+		if (rank > '1') ss << '/';
+	}
+	ss << (turn == white ? " w " : " b ");
+	if (!(_castling & WhiteCanCastleKingsideMask)) ss << 'K';
+	if (!(_castling & WhiteCanCastleQueensideMask)) ss << 'Q';
+	if (!(_castling & BlackCanCastleKingsideMask)) ss << 'k';
+	if (!(_castling & BlackCanCastleQueensideMask)) ss << 'q';
+	if ((_castling & 0x0f) == 0x0f) ss << '-';
+	ss << " - " << halfmoves << " 1";
+	return ss.str();
+}
+// Puts a piece of the given kind on the square, using a spare pawn as a
+// promoted piece once the regular pieces of that kind are used up
+void Position::placePiece(char pc, color c, square s) {
+	piece first, last;
+	switch (pc) {
+	case pawn:
+		if (RankIdxForSquare(s) == 0 || RankIdxForSquare(s) == 7) throw runtime_error("pawn on last rank");
+		first = white_p1; last = white_p8; break;
+	case rook: first = s == sq_h1 || s == sq_h8 ? white_r2 : white_r1; last = white_r2; break;
+	case knight: first = white_n1; last = white_n2; break;
+	case bishop: first = white_b1; last = white_b2; break;
+	case queen: first = last = white_q; break;
+	default: first = last = white_k; break;
+	}
+	piece p = nopiece;
+	for (piece i = 16*c + first; i <= 16*c + last; i++) {
+		if (_positions[i] == TakenMask) {
+			p = i;
+			break;
+		}
+	}
+	if (p == nopiece && pc != pawn && pc != king) {
+		for (piece i = 16*c + white_p1; i <= 16*c + white_p8; i++) {
+			if (_positions[i] == TakenMask) {
+				p = i;
+				break;
+			}
+		}
+		if (p != nopiece) {
+			_positions[p] = PromotionMask;
+			promotePawn(p,pc);
+		}
+	}
+	if (p == nopiece && pc == king) throw runtime_error("FEN has more than one king");
+	if (p == nopiece) throw runtime_error("too many pieces in FEN");
+	_positions[p] = s | (_positions[p] & PromotionMask);
+	_board[s] = p;
+	_boardmasks[c] |= (u64)1 << s;
+}
 int Position::value() const {
 	switch (matingSequence()) {
 	case MSWhiteR: case MSWhiteQ: return WhiteMate + 3 - StepsToCorner(squareForPiece(black_k));
 	case MSBlackR: case MSBlackQ: return BlackMate - 3 + StepsToCorner(squareForPiece(white_k));
 	}
-	int val = numForPieceChar('p',white)*PawnWeight - numForPieceChar('p',black)*PawnWeight
-			+ numForPieceChar('N',white)*KnightWeight - numForPieceChar('N',black)*KnightWeight
-			+ numForPieceChar('B',white)*BishopWeight - numForPieceChar('B',black)*BishopWeight
-			+ numForPieceChar('R',white)*RookWeight - numForPieceChar('R',black)*RookWeight
-			+ numForPieceChar('Q',white)*QueenWeight - numForPieceChar('Q',black)*QueenWeight;
+	static const int weights[NumKinds] = { PawnWeight, RookWeight, KnightWeight, BishopWeight, QueenWeight, 0 };
+	int val = 0;
+	for (int k = 0; k < KindKing; k++) {
+		val += (CountBitsU64(_pieces[white][k]) - CountBitsU64(_pieces[black][k]))*weights[k];
+	}
 	val *= PiecesWeight;
 	int pres, cov, prot;
 	pcp(&pres,&cov,&prot);
@@ -79,189 +231,66 @@ color Position::squareColor(square s) const {
 	if (_boardmasks[black] & ((u64)1 << s)) return black;
 	return emptycolor;
 }
+u64 Position::boardmask(color c) const {
+	return _boardmasks[c];
+}
 bool Position::squareEmpty(square s) const {
 	return squareColor(s) == emptycolor;
 }
 piece Position::pieceForSquareAndColor(square s, color c) const {
-	int start = c * 16;
-	for (int i = 0; i < 16; i++) {
-		if (_positions[start+i] == s) return start+i;
-		if ((_positions[start+i] & ~PromotionMask) == s) {
-			// i < 8
-			int shift = 2*i + start;
-			u32 mask = 3 << shift;
-			return IdxForPieceChar(PromotionCharForIdx((_promotions & mask) >> shift),c);
-		}
+	piece p = _board[s];
+	if (p == nopiece || (p >= 16) != c) return nopiece;
+	if (_positions[p] & PromotionMask) {
+		return IdxForPieceChar(promotionCharForPromotedPawn(p),c);
 	}
-	return nopiece;
+	return p;
 }
 square Position::squareForPiece(piece p) const {
 	return _positions[p];
 }
 bool Position::inCheck(color c) const {
+	return checkers(c) != 0;
+}
+// Pieces of the opposite color giving check to the king of the given color
+u64 Position::checkers(color c) const {
+	return attackersTo(squareForPiece(c == white ? white_k : black_k),OppositeColor(c));
+}
+// Pieces of the given color that can't leave the line between their king and
+// an enemy slider
+u64 Position::pinned(color c) const {
 	square ks = squareForPiece(c == white ? white_k : black_k);
-	color oc = OppositeColor(c);
-	square cs;
-	piece p;
-	char pc;
-	// NOTE: could make more efficient
-	// Check pawn moves
-	if (c == white) {
-		if (HasSquareAboveRight(ks)) {
-			cs = SquareAboveRight(ks);
-			p = pieceForSquareAndColor(cs,oc);
-			if (PieceCharForIdx(p) == pawn) return true;
-		}
-		if (HasSquareAboveLeft(ks)) {
-			cs = SquareAboveLeft(ks);
-			p = pieceForSquareAndColor(cs,oc);
-			if (PieceCharForIdx(p) == pawn) return true;
-		}
-	} else {
-		if (HasSquareBelowRight(ks)) {
-			cs = SquareBelowRight(ks);
-			p = pieceForSquareAndColor(cs,oc);
-			if (PieceCharForIdx(p) == pawn) return true;
-		}
-		if (HasSquareBelowLeft(ks)) {
-			cs = SquareBelowLeft(ks);
-			p = pieceForSquareAndColor(cs,oc);
-			if (PieceCharForIdx(p) == pawn) return true;
-		}
-	}
-	// Check knight's moves
-	if (HasSquareUUR(ks)) {
-		cs = SquareUUR(ks);
-		p = pieceForSquareAndColor(cs,oc);
-		if (PieceCharForIdx(p) == knight) return true;
-	}
-	if (HasSquareUUL(ks)) {
-		cs = SquareUUL(ks);
-		p = pieceForSquareAndColor(cs,oc);
-		if (PieceCharForIdx(p) == knight) return true;
-	}
-	if (HasSquareRRU(ks)) {
-		cs = SquareRRU(ks);
-		p = pieceForSquareAndColor(cs,oc);
-		if (PieceCharForIdx(p) == knight) return true;
-	}
-	if (HasSquareRRD(ks)) {
-		cs = SquareRRD(ks);
-		p = pieceForSquareAndColor(cs,oc);
-		if (PieceCharForIdx(p) == knight) return true;
-	}
-	if (HasSquareLLU(ks)) {
-		cs = SquareLLU(ks);
-		p = pieceForSquareAndColor(cs,oc);
-		if (PieceCharForIdx(p) == knight) return true;
-	}
-	if (HasSquareLLD(ks)) {
-		cs = SquareLLD(ks);
-		p = pieceForSquareAndColor(cs,oc);
-		if (PieceCharForIdx(p) == knight) return true;
-	}
-	if (HasSquareDDR(ks)) {
-		cs = SquareDDR(ks);
-		p = pieceForSquareAndColor(cs,oc);
-		if (PieceCharForIdx(p) == knight) return true;
-	}
-	if (HasSquareDDL(ks)) {
-		cs = SquareDDL(ks);
-		p = pieceForSquareAndColor(cs,oc);
-		if (PieceCharForIdx(p) == knight) return true;
-	}
-	// Check ranks and files
-	color sc;
-	cs = ks;
-	while (HasSquareAbove(cs)) {
-		cs = SquareAbove(cs);
-		sc = squareColor(cs);
-		if (sc == emptycolor) continue;
-		if (sc == c) break; // Piece of same color
-		p = pieceForSquareAndColor(cs,oc);
-		pc = PieceCharForIdx(p);
-		if (pc == rook || pc == queen || (pc == king && cs == SquareAbove(ks))) return true;
-		break;
-	}
-	cs = ks;
-	while (HasSquareBelow(cs)) {
-		cs = SquareBelow(cs);
-		sc = squareColor(cs);
-		if (sc == emptycolor) continue;
-		if (sc == c) break; // Piece of same color
-		p = pieceForSquareAndColor(cs,oc);
-		pc = PieceCharForIdx(p);
-		if (pc == rook || pc == queen || (pc == king && cs == SquareBelow(ks))) return true;
-		break;
-	}
-	cs = ks;
-	while (HasSquareRight(cs)) {
-		cs = SquareRight(cs);
-		sc = squareColor(cs);
-		if (sc == emptycolor) continue;
-		if (sc == c) break; // Piece of same color
-		p = pieceForSquareAndColor(cs,oc);
-		pc = PieceCharForIdx(p);
-		if (pc == rook || pc == queen || (pc == king && cs == SquareRight(ks))) return true;
-		break;
-	}
-	cs = ks;
-	while (HasSquareLeft(cs)) {
-		cs = SquareLeft(cs);
-		sc = squareColor(cs);
-		if (sc == emptycolor) continue;
-		if (sc == c) break; // Piece of same color
-		p = pieceForSquareAndColor(cs,oc);
-		pc = PieceCharForIdx(p);
-		if (pc == rook || pc == queen || (pc == king && cs == SquareLeft(ks))) return true;
-		break;
-	}
-	// Check diagonals
-	cs = ks;
-	while (HasSquareAboveRight(cs)) {
-		cs = SquareAboveRight(cs);
-		sc = squareColor(cs);
-		if (sc == emptycolor) continue;
-		if (sc == c) break; // Piece of same color
-		p = pieceForSquareAndColor(cs,oc);
-		pc = PieceCharForIdx(p);
-		if (pc == bishop || pc == queen || (pc == king && cs == SquareAboveRight(ks))) return true;
-		break;
-	}
-	cs = ks;
-	while (HasSquareAboveLeft(cs)) {
-		cs = SquareAboveLeft(cs);
-		sc = squareColor(cs);
-		if (sc == emptycolor) continue;
-		if (sc == c) break; // Piece of same color
-		p = pieceForSquareAndColor(cs,oc);
-		pc = PieceCharForIdx(p);
-		if (pc == bishop || pc == queen || (pc == king && cs == SquareAboveLeft(ks))) return true;
-		break;
-	}
-	cs = ks;
-	while (HasSquareBelowRight(cs)) {
-		cs = SquareBelowRight(cs);
-		sc = squareColor(cs);
-		if (sc == emptycolor) continue;
-		if (sc == c) break; // Piece of same color
-		p = pieceForSquareAndColor(cs,oc);
-		pc = PieceCharForIdx(p);
-		if (pc == bishop || pc == queen || (pc == king && cs == SquareBelowRight(ks))) return true;
-		break;
-	}
-	cs = ks;
-	while (HasSquareBelowLeft(cs)) {
-		cs = SquareBelowLeft(cs);
-		sc = squareColor(cs);
-		if (sc == emptycolor) continue;
-		if (sc == c) break; // Piece of same color
-		p = pieceForSquareAndColor(cs,oc);
-		pc = PieceCharForIdx(p);
-		if (pc == bishop || pc == queen || (pc == king && cs == SquareBelowLeft(ks))) return true;
-		break;
-	}
-	return false;
+	const u64 *pieces = _pieces[OppositeColor(c)];
+	u64 diagonals = pieces[KindBishop] | pieces[KindQueen];
+	u64 straights = pieces[KindRook] | pieces[KindQueen];
+	// Sliders that would attack the king if our own pieces weren't there
+	u64 theirs = _boardmasks[OppositeColor(c)];
+	u64 snipers = (RookAttacks(ks,theirs) & straights) | (BishopAttacks(ks,theirs) & diagonals);
+	u64 pins = 0;
+	while (snipers) {
+		square s = LowestBitU64(snipers);
+		snipers &= snipers - 1;
+		u64 blockers = BetweenMasks[ks][s] & (_boardmasks[white] | _boardmasks[black]);
+		if (CountBitsU64(blockers) == 1) pins |= blockers & _boardmasks[c];
+	}
+	return pins;
+}
+// Whether a piece of the given color attacks the square, for the given board
+// occupancy
+bool Position::squareAttacked(square s, color by, u64 occ) const {
+	return attackersTo(s,by,occ) != 0;
+}
+// Pieces of the given color attacking the square
+u64 Position::attackersTo(square s, color by) const {
+	return attackersTo(s,by,_boardmasks[white] | _boardmasks[black]);
+}
+// As above, with sliders blocked by the given occupancy instead of the board's
+u64 Position::attackersTo(square s, color by, u64 occ) const {
+	const u64 *pieces = _pieces[by];
+	return (PawnAttacks[OppositeColor(by)][s] & pieces[KindPawn]) |
+		(KnightAttacks[s] & pieces[KindKnight]) |
+		(KingAttacks[s] & pieces[KindKing]) |
+		(BishopAttacks(s,occ) & (pieces[KindBishop] | pieces[KindQueen])) |
+		(RookAttacks(s,occ) & (pieces[KindRook] | pieces[KindQueen]));
 }
 int Position::numForColor(color c) const {
 	return CountBitsU64(_boardmasks[c]);
@@ -277,31 +306,11 @@ int Position::numForColorInFile(color c, char file) const {
 	return num;
 }
 int Position::numForPieceChar(char pc, color c) const {
-	int start = 16*c, num = 2;
-	switch (pc) {
-	case pawn: num = 8; break;
-	case rook: start += white_r1; break;
-	case knight: start += white_n1; break;
-	case bishop: start += white_b1; break;
-	case queen: start += white_q; num = 1; break;
-	case king: start += white_k; num = 1; break;
-	default: throw runtime_error("Bad piece char");
-	}
-	int cnt = 0;
-	for (int i = 0; i < num; i++) {
-		if (!(_positions[start+i] & TakenMask)) cnt++;
-	}
-	start = c*16;
-	if (IsPromotionChar(pc)) {
-		for (int i = 0; i < 8; i++) {
-			if ((_positions[start+i] & PromotionMask) && !(_positions[i] & TakenMask)) {
-				int shift = 2*i + start;
-				u32 mask = 3 << shift;
-				if (pc == PromotionCharForIdx((_promotions & mask) >> shift)) cnt++;
-			}
-		}
-	}
-	return cnt;
+	if (!IsPieceChar(pc)) throw runtime_error("Bad piece char");
+	return CountBitsU64(_pieces[c][KindForPieceChar(pc)]);
+}
+u64 Position::piecesOfKind(int kind, color c) const {
+	return _pieces[c][kind];
 }
 char Position::promotionCharForPromotedPawn(piece p) const {
 	int shift = p >= 16 ? 2*(p-8) : 2*p;
@@ -309,75 +318,319 @@ char Position::promotionCharForPromotedPawn(piece p) const {
 	return PromotionCharForIdx((_promotions & mask) >> shift);
 }
 void Position::movePiece(piece p, square tosquare) {
-	square fromsquare = _positions[p];
-	_positions[p] = tosquare | (fromsquare & PromotionMask);
+	square fromsquare = _positions[p] & ~PromotionMask;
+	_key ^= pieceKey(p);
+	_positions[p] = tosquare | (_positions[p] & PromotionMask);
+	_key ^= pieceKey(p);
 	color c = (p >= 16);
+	_pieces[c][pieceKind(p)] ^= ((u64)1 << fromsquare) | ((u64)1 << tosquare);
 	_boardmasks[c] = (_boardmasks[c] & ~((u64)1 << fromsquare)) | ((u64)1 << tosquare);
+	_board[fromsquare] = nopiece;
+	_board[tosquare] = p;
 }
 void Position::takePiece(piece p, square tosquare) {
-	square fromsquare = _positions[p];
-	_positions[p] = tosquare | (fromsquare & PromotionMask);
+	piece taken = _board[tosquare];
+	_key ^= pieceKey(taken);
+	_positions[taken] |= TakenMask;
 	color c = (p >= 16);
-	_boardmasks[c] = (_boardmasks[c] & ~((u64)1 << (fromsquare & ~PromotionMask))) | ((u64)1 << tosquare);
+	_pieces[OppositeColor(c)][pieceKind(taken)] &= ~((u64)1 << tosquare);
 	_boardmasks[OppositeColor(c)] &= ~((u64)1 << tosquare);
-	if (c == white) { // Take black piece
-		for (int i = 16; i < 32; i++) if ((_positions[i] & ~PromotionMask) == tosquare) _positions[i] |= TakenMask;
-	} else { // Take white piece
-		for (int i = 0; i < 16; i++) if ((_positions[i] & ~PromotionMask) == tosquare) _positions[i] |= TakenMask;
-	}
+	movePiece(p,tosquare);
 }
 void Position::promotePawn(piece p, char pc) {
+	u64 bit = (u64)1 << (_positions[p] & ~PromotionMask);
+	color c = (p >= 16);
+	_key ^= pieceKey(p);
+	_pieces[c][pieceKind(p)] &= ~bit;
 	_positions[p] |= PromotionMask;
 	int shift = p > 8 ? 2*(p - 8) : 2*p;
 	u32 mask = 3 << shift;
 	_promotions = (_promotions & ~mask) | (IdxForPromotionChar(pc) << shift);
+	_key ^= pieceKey(p);
+	_pieces[c][pieceKind(p)] |= bit;
 }
-bool Position::operator ==(const Position &p) const {
-	return memcmp(this,&p,sizeof(Position)) == 0;
+// Castling rights lost by moving from or to the given square
+static u8 CastlingMaskForSquare(square s) {
+	switch (s) {
+	case sq_h1: return WhiteCanCastleKingsideMask;
+	case sq_a1: return WhiteCanCastleQueensideMask;
+	case sq_e1: return WhiteCanCastleKingsideMask | WhiteCanCastleQueensideMask;
+	case sq_h8: return BlackCanCastleKingsideMask;
+	case sq_a8: return BlackCanCastleQueensideMask;
+	case sq_e8: return BlackCanCastleKingsideMask | BlackCanCastleQueensideMask;
+	default: return 0;
+	}
 }
-Move Position::moveToPositionForColor(const Position &pos, color c) const {
-	color oc = OppositeColor(c);
-	u64 ourChanges = _boardmasks[c] ^ pos._boardmasks[c];
-	u64 ourVacancies = ourChanges & ~pos._boardmasks[c];
-	if (CountBitsU64(ourVacancies) == 2) {
-		// Castle
-		Move m;
-		if ((ourChanges & 0x0f) == 0x0f && c == white) m.special = smCastleKingside;
-		else if ((ourChanges & 0xb8) == 0xb8 && c == white) m.special = smCastleQueenside;
-		else if ((ourChanges & 0x0f00000000000000) == 0x0f00000000000000 && c == black) m.special = smCastleKingside;
-		else if ((ourChanges & 0xb800000000000000) == 0xb800000000000000 && c == black) m.special = smCastleQueenside;
-		else throw runtime_error("no move to result in position. vacancies: 2");
-		return m;
-	} else if (CountBitsU64(ourVacancies) != 1) {
-		std::stringstream ss;
-		ss << "no move to result in position. vacancies: " << CountBitsU64(ourVacancies);
-		throw runtime_error(ss.str().c_str());
-	}
-	u64 dest = ourChanges & pos._boardmasks[c];
+void Position::makeMove(piece p, square to, char promotion, Undo *undo) {
+	undo->moved = p;
+	undo->from = _positions[p];
+	undo->captured = nopiece;
+	undo->castledRook = nopiece;
+	undo->promotions = _promotions;
+	undo->castling = _castling;
+	undo->key = _key;
+	square from = _positions[p] & ~PromotionMask;
+	if (to & TakesMask) {
+		to &= ~TakesMask;
+		undo->captured = _board[to];
+		takePiece(p,to);
+	} else {
+		movePiece(p,to);
+	}
+	if (promotion) promotePawn(p,promotion);
+	_castling |= CastlingMaskForSquare(from) | CastlingMaskForSquare(to);
+	_key ^= ZobristCastling[undo->castling] ^ ZobristCastling[_castling] ^ ZobristBlackToMove;
+}
+void Position::makeCastle(color c, u8 side, Undo *undo) {
+	piece k = c == white ? white_k : black_k;
+	piece r;
+	square kto, rto;
+	if (side == smCastleKingside) {
+		r = c == white ? white_r2 : black_r2;
+		kto = c == white ? sq_g1 : sq_g8;
+		rto = c == white ? sq_f1 : sq_f8;
+	} else {
+		r = c == white ? white_r1 : black_r1;
+		kto = c == white ? sq_c1 : sq_c8;
+		rto = c == white ? sq_d1 : sq_d8;
+	}
+	undo->moved = k;
+	undo->from = _positions[k];
+	undo->captured = nopiece;
+	undo->castledRook = r;
+	undo->castledFrom = _positions[r];
+	undo->promotions = _promotions;
+	undo->castling = _castling;
+	undo->key = _key;
+	movePiece(k,kto);
+	movePiece(r,rto);
+	_castling |= CastlingMaskForSquare(undo->from);
+	_key ^= ZobristCastling[undo->castling] ^ ZobristCastling[_castling] ^ ZobristBlackToMove;
+}
+void Position::unmakeMove(const Undo &undo) {
+	if (undo.castledRook != nopiece) movePiece(undo.castledRook,undo.castledFrom);
+	piece p = undo.moved;
+	color c = (p >= 16);
+	square to = _positions[p] & ~PromotionMask;
+	square from = undo.from & ~PromotionMask;
+	// The piece goes back as what it was, which undoes a promotion
+	_pieces[c][pieceKind(p)] &= ~((u64)1 << to);
+	_positions[p] = undo.from;
+	_promotions = undo.promotions;
+	_pieces[c][pieceKind(p)] |= (u64)1 << from;
+	_boardmasks[c] ^= ((u64)1 << to) | ((u64)1 << from);
+	_board[to] = nopiece;
+	_board[from] = p;
+	if (undo.captured != nopiece) {
+		_positions[undo.captured] &= ~TakenMask;
+		_boardmasks[undo.captured >= 16] |= (u64)1 << to;
+		_pieces[undo.captured >= 16][pieceKind(undo.captured)] |= (u64)1 << to;
+		_board[to] = undo.captured;
+	}
+	_castling = undo.castling;
+	_key = undo.key;
+}
+void Position::makeMove(PackedMove m, Undo *undo) {
+	piece p = _board[m.from()];
+	if (m.castle()) {
+		makeCastle(p >= 16,m.castle(),undo);
+	} else {
+		makeMove(p,m.to() | (m.takes() ? TakesMask : 0),m.promotionChar(),undo);
+	}
+}
+void Position::legalMoves(color c, MoveList *list) const {
+	if (c == white) {
+		generateMoves<white>(list);
+	} else {
+		generateMoves<black>(list);
+	}
+}
+// Squares a piece may move to without exposing its king
+u64 Position::allowedFor(square s, square ks, u64 evasions, u64 pinned) {
+	if (pinned & ((u64)1 << s)) return evasions & LineMasks[ks][s];
+	return evasions;
+}
+void Position::addMoves(square from, u64 targets, u64 theirs, MoveList *list) {
+	for (; targets; targets &= targets - 1) {
+		square to = LowestBitU64(targets);
+		list->push(PackedMove(from,to,theirs & ((u64)1 << to) ? PMTakes : 0));
+	}
+}
+// Check and pins are worked out once, so that no move leaving the king in
+// check is ever generated.
+template<color C> void Position::generateMoves(MoveList *list) const {
+	const color oc = C == white ? black : white;
+	const u64 *pieces = _pieces[C];
+	u64 ours = _boardmasks[C], theirs = _boardmasks[oc];
+	u64 occ = ours | theirs;
+	square ks = LowestBitU64(pieces[KindKing]);
+	u64 checkers = attackersTo(ks,oc,occ);
+	u64 pins = pinned(C);
+	// Squares that resolve a check: capturing the checker or blocking it.
+	// In double check there are none, and only the king can move.
+	u64 evasions = ~(u64)0;
+	if (checkers) {
+		evasions = CountBitsU64(checkers) > 1 ? 0 : checkers | BetweenMasks[ks][LowestBitU64(checkers)];
+	}
+	// Castling, neither out of, through, nor into check
+	if (!checkers && !(_castling & (C == white ? WhiteCanCastleKingsideMask : BlackCanCastleKingsideMask))) {
+		const square f = C == white ? sq_f1 : sq_f8, g = C == white ? sq_g1 : sq_g8;
+		if (!(occ & ((u64)1 << f | (u64)1 << g)) &&
+			_board[C == white ? sq_h1 : sq_h8] == (C == white ? white_r2 : black_r2) &&
+			!squareAttacked(f,oc,occ) &&
+			!squareAttacked(g,oc,occ)) {
+			list->push(PackedMove(ks,g,PMCastleKingside));
+		}
+	}
+	if (!checkers && !(_castling & (C == white ? WhiteCanCastleQueensideMask : BlackCanCastleQueensideMask))) {
+		const square d = C == white ? sq_d1 : sq_d8, c = C == white ? sq_c1 : sq_c8, b = C == white ? sq_b1 : sq_b8;
+		if (!(occ & ((u64)1 << d | (u64)1 << c | (u64)1 << b)) &&
+			_board[C == white ? sq_a1 : sq_a8] == (C == white ? white_r1 : black_r1) &&
+			!squareAttacked(d,oc,occ) &&
+			!squareAttacked(c,oc,occ)) {
+			list->push(PackedMove(ks,c,PMCastleQueenside));
+		}
+	}
+	// Pawn moves
+	const int forward = C == white ? DirAbove : DirBelow;
+	for (u64 b = pieces[KindPawn]; b; b &= b - 1) {
+		square ps = LowestBitU64(b);
+		u64 targets = PawnAttacks[C][ps] & theirs;
+		square cs = Neighbors[forward][ps];
+		if (!(occ & ((u64)1 << cs))) {
+			targets |= (u64)1 << cs;
+			// Double-step from starting rank
+			cs = Neighbors[forward][cs];
+			if (RankIdxForSquare(ps) == (C == white ? 1 : 6) && !(occ & ((u64)1 << cs))) {
+				targets |= (u64)1 << cs;
+			}
+		}
+		targets &= allowedFor(ps,ks,evasions,pins);
+		// TODO: en passant
+		if (RankIdxForSquare(ps) != (C == white ? 6 : 1)) {
+			addMoves(ps,targets,theirs,list);
+			continue;
+		}
+		// Promotion on last rank
+		for (; targets; targets &= targets - 1) {
+			square to = LowestBitU64(targets);
+			u16 takes = theirs & ((u64)1 << to) ? PMTakes : 0;
+			for (u16 i = 0; i < 4; i++) {
+				list->push(PackedMove(ps,to,takes | PMPromotion | i << PMSpecialShift));
+			}
+		}
+	}
+	// Rook, knight, bishop and queen moves
+	for (u64 b = pieces[KindRook]; b; b &= b - 1) {
+		square s = LowestBitU64(b);
+		addMoves(s,RookAttacks(s,occ) & ~ours & allowedFor(s,ks,evasions,pins),theirs,list);
+	}
+	for (u64 b = pieces[KindKnight]; b; b &= b - 1) {
+		square s = LowestBitU64(b);
+		addMoves(s,KnightAttacks[s] & ~ours & allowedFor(s,ks,evasions,pins),theirs,list);
+	}
+	for (u64 b = pieces[KindBishop]; b; b &= b - 1) {
+		square s = LowestBitU64(b);
+		addMoves(s,BishopAttacks(s,occ) & ~ours & allowedFor(s,ks,evasions,pins),theirs,list);
+	}
+	for (u64 b = pieces[KindQueen]; b; b &= b - 1) {
+		square s = LowestBitU64(b);
+		addMoves(s,QueenAttacks(s,occ) & ~ours & allowedFor(s,ks,evasions,pins),theirs,list);
+	}
+	// King moves, to squares not attacked once the king has left
+	u64 targets = KingAttacks[ks] & ~ours;
+	for (u64 b = targets; b; b &= b - 1) {
+		square s = LowestBitU64(b);
+		if (squareAttacked(s,oc,occ & ~((u64)1 << ks))) targets &= ~((u64)1 << s);
+	}
+	addMoves(ks,targets,theirs,list);
+}
+Move Position::moveForPacked(PackedMove pm) const {
 	Move m;
-	square vacated = squareForBoardmask(ourVacancies);
-	m.piecechar = PieceCharForIdx(pieceForSquareAndColor(vacated,c));
-	m.file = FileCharForSquare(vacated);
-	m.rank = RankCharForSquare(vacated);
-	u64 theirChanges = _boardmasks[oc] ^ pos._boardmasks[oc];
-	u64 theirVacancies = theirChanges & ~pos._boardmasks[oc];
-	m.takes = !!theirVacancies;
-	m.to = squareForBoardmask(dest);
-	char tochar = PieceCharForIdx(pos.pieceForSquareAndColor(m.to,c));
-	if (m.piecechar != tochar) {
-		m.promotionchar = tochar;
-	}
-	if (pos.inCheck(oc)) m.check = 1;
+	square from = pm.from();
+	color c = _board[from] >= 16;
+	if (pm.castle()) {
+		m.special = pm.castle();
+	} else {
+		char pc = PieceCharForIdx(pieceForSquareAndColor(from,c));
+		if (pc != pawn) m.piecechar = pc;
+		m.file = FileCharForSquare(from);
+		m.rank = RankCharForSquare(from);
+		m.takes = pm.takes();
+		m.to = pm.to();
+		m.promotionchar = pm.promotionChar();
+	}
+	Position next = *this;
+	Undo undo;
+	next.makeMove(pm,&undo);
+	m.check = next.inCheck(OppositeColor(c));
 	return m;
 }
-square Position::squareForBoardmask(u64 bm) {
-	if (bm == 0) return nosquare;
-	square s = 0;
-	for (; 1; s++) {
-		if (bm & 1) return s;
-		bm >>= 1;
+int Position::movesMatching(const Move &m, const MoveList &legal, PackedMove *match) const {
+	int num = 0;
+	for (int i = 0; i < legal.size; i++) {
+		PackedMove pm = legal[i];
+		if (m.special & (smCastleKingside|smCastleQueenside)) {
+			if (pm.castle() != (m.special & (smCastleKingside|smCastleQueenside))) continue;
+		} else {
+			square from = pm.from();
+			char pc = PieceCharForIdx(pieceForSquareAndColor(from,_board[from] >= 16));
+			if (pm.castle() || pm.to() != m.to) continue;
+			if (pc != (m.piecechar ? m.piecechar : pawn)) continue;
+			if (m.takes && !pm.takes()) continue;
+			if (m.file && FileCharForSquare(from) != m.file) continue;
+			if (m.rank && RankCharForSquare(from) != m.rank) continue;
+			if (pm.promotionChar() != m.promotionchar) continue;
+		}
+		if (num++ == 0) *match = pm;
+	}
+	return num;
+}
+bool Position::operator ==(const Position &p) const {
+	return memcmp(this,&p,sizeof(Position)) == 0;
+}
+u64 Position::key() const {
+	return _key;
+}
+u64 Position::computeKey() const {
+	u64 k = ZobristCastling[_castling];
+	for (piece i = 0; i < 32; i++) {
+		if (!(_positions[i] & TakenMask)) k ^= pieceKey(i);
+	}
+	return k;
+}
+// Kind of a piece, that of the piece it was promoted to for a promoted pawn
+int Position::pieceKind(piece p) const {
+	static const u8 kinds[16] = {
+		KindPawn, KindPawn, KindPawn, KindPawn, KindPawn, KindPawn, KindPawn, KindPawn,
+		KindRook, KindRook, KindKnight, KindKnight, KindBishop, KindBishop, KindQueen, KindKing
+	};
+	static const u8 promotedKinds[4] = { KindKnight, KindBishop, KindRook, KindQueen };
+	if (_positions[p] & PromotionMask) {
+		int shift = p >= 16 ? 2*(p-8) : 2*p;
+		return promotedKinds[(_promotions >> shift) & 3];
+	}
+	return kinds[p & 15];
+}
+// Key of a piece on its square
+u64 Position::pieceKey(piece p) const {
+	int kind = pieceKind(p);
+	return ZobristPieces[p >= 16 ? kind + NumKinds : kind][_positions[p] & ~(PromotionMask|TakenMask)];
+}
+// Piece bitboards from scratch, once the piece list is set up
+void Position::setPieceMasks() {
+	for (color c = white; c <= black; c++) {
+		for (int k = 0; k < NumKinds; k++) _pieces[c][k] = 0;
+	}
+	for (piece i = 0; i < 32; i++) {
+		if (!(_positions[i] & TakenMask)) {
+			_pieces[i >= 16][pieceKind(i)] |= (u64)1 << (_positions[i] & ~PromotionMask);
+		}
 	}
 }
+square Position::squareForBoardmask(u64 bm) {
+	return LowestBitU64(bm); // nosquare if empty
+}
 string Position::stringForFileLabels() {
 	return "     a   b   c   d   e   f   g   h     ";
 }
@@ -426,373 +679,44 @@ ms Position::matingSequence() const {
 // Pressure, coverage, protection
 void Position::pcp(int *pres, int *cov, int *prot) const {
 	int wpres, wcov, wprot;
-	pcpFor(white,&wpres,&wcov,&wprot);
+	pcpFor<white>(&wpres,&wcov,&wprot);
 	int bpres, bcov, bprot;
-	pcpFor(black,&bpres,&bcov,&bprot);
+	pcpFor<black>(&bpres,&bcov,&bprot);
 	*pres = wpres - bpres;
 	*cov = wcov - bcov;
 	*prot = wprot - bprot;
 }
 void Position::pcpFor(color c, int *pres, int *cov, int *prot) const {
-	*pres = *cov = *prot = 0;
-	color oc = OppositeColor(c);
-	piece p = c*16;
-	square s;
-	// pawn pcp
 	if (c == white) {
-		for (; !(p & 8); p++) {
-			if (_positions[p] & TakenMask) {
-				continue;
-			}
-			s = squareForPiece(p);
-			if (HasSquareAboveRight(s)) {
-				if (squareColor(SquareAboveRight(s)) == oc) (*pres)++;
-				else if (squareColor(SquareAboveRight(s)) == c) (*prot)++;
-				else (*cov)++;
-			}
-			if (HasSquareAboveLeft(s)) {
-				if (squareColor(SquareAboveLeft(s)) == oc) (*pres)++;
-				else if (squareColor(SquareAboveLeft(s)) == c) (*prot)++;
-				else (*cov)++;
-			}
-		}
+		pcpFor<white>(pres,cov,prot);
 	} else {
-		for (; !(p & 8); p++) {
-			if (_positions[p] & TakenMask) {
-				continue;
-			}
-			s = squareForPiece(p);
-			if (HasSquareBelowRight(s)) {
-				if (squareColor(SquareBelowRight(s)) == oc) (*pres)++;
-				else if (squareColor(SquareBelowRight(s)) == c) (*prot)++;
-				else (*cov)++;
-			}
-			if (HasSquareBelowLeft(s)) {
-				if (squareColor(SquareBelowLeft(s)) == oc) (*pres)++;
-				else if (squareColor(SquareBelowLeft(s)) == c) (*prot)++;
-				else (*cov)++;
-			}
-		}
-	}
-	// rook pcp
-	for (; !(p & 2); p++) {
-		if (!(_positions[p] & TakenMask)) {
-			rookPcp(c,squareForPiece(p),pres,cov,prot);
-		}
-	}
-	// knight pcp
-	for (; p & 2; p++) {
-		if (!(_positions[p] & TakenMask)) {
-			knightPcp(c,squareForPiece(p),pres,cov,prot);
-		}
-	}
-	// bishop pcp
-	for (; !(p & 2); p++) {
-		if (!(_positions[p] & TakenMask)) {
-			bishopPcp(c,squareForPiece(p),pres,cov,prot);
-		}
-	}
-	// queen pressure
-	if (!(_positions[p] & TakenMask)) {
-		rookPcp(c,squareForPiece(p),pres,cov,prot);
-		bishopPcp(c,squareForPiece(p),pres,cov,prot);
+		pcpFor<black>(pres,cov,prot);
 	}
-	p++;
-	// king pressure
-	kingPcp(c,squareForPiece(p),pres,cov,prot);
 }
-void Position::rookPcp(color c, square rs, int *pres, int *cov, int *prot) const {
-	color oc = OppositeColor(c);
-	square s = rs;
-	while (HasSquareAbove(s)) {
-		s = SquareAbove(s);
-		if (squareColor(s) == oc) {
-			(*pres)++;
-			break;
-		} else if (squareColor(s) == c) {
-			(*prot)++;
-			break;
-		}
-		(*cov)++;
-	}
-	s = rs;
-	while (HasSquareBelow(s)) {
-		s = SquareBelow(s);
-		if (squareColor(s) == oc) {
-			(*pres)++;
-			break;
-		} else if (squareColor(s) == c) {
-			(*prot)++;
-			break;
-		}
-		(*cov)++;
-	}
-	s = rs;
-	while (HasSquareRight(s)) {
-		s = SquareRight(s);
-		if (squareColor(s) == oc) {
-			(*pres)++;
-			break;
-		} else if (squareColor(s) == c) {
-			(*prot)++;
-			break;
-		}
-		(*cov)++;
-	}
-	s = rs;
-	while (HasSquareLeft(s)) {
-		s = SquareLeft(s);
-		if (squareColor(s) == oc) {
-			(*pres)++;
-			break;
-		} else if (squareColor(s) == c) {
-			(*prot)++;
-			break;
-		}
-		(*cov)++;
-	}
-}
-void Position::bishopPcp(color c, square bs, int *pres, int *cov, int *prot) const {
-	color oc = OppositeColor(c);
-	square s = bs;
-	color sc;
-	while (HasSquareAboveRight(s)) {
-		s = SquareAboveRight(s);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-			break;
-		} else if (sc == c) {
-			(*prot)++;
-			break;
-		}
-		(*cov)++;
-	}
-	s = bs;
-	while (HasSquareBelowRight(s)) {
-		s = SquareBelowRight(s);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-			break;
-		} else if (sc == c) {
-			(*prot)++;
-			break;
-		}
-		(*cov)++;
-	}
-	s = bs;
-	while (HasSquareAboveLeft(s)) {
-		s = SquareAboveLeft(s);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-			break;
-		} else if (sc == c) {
-			(*prot)++;
-			break;
-		}
-		(*cov)++;
-	}
-	s = bs;
-	while (HasSquareBelowLeft(s)) {
-		s = SquareBelowLeft(s);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-			break;
-		} else if (sc == c) {
-			(*prot)++;
-			break;
-		}
-		(*cov)++;
-	}
-}
-void Position::kingPcp(color c, square ks, int *pres, int *cov, int *prot) const {
-	color oc = OppositeColor(c);
-	square s;
-	color sc;
-	if (HasSquareAbove(ks)) {
-		s = SquareAbove(ks);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
-	if (HasSquareAboveRight(ks)) {
-		s = SquareAboveRight(ks);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
-	if (HasSquareRight(ks)) {
-		s = SquareRight(ks);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
-	if (HasSquareBelowRight(ks)) {
-		s = SquareBelowRight(ks);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
+template<color C> void Position::pcpFor(int *pres, int *cov, int *prot) const {
+	*pres = *cov = *prot = 0;
+	u64 occ = _boardmasks[white] | _boardmasks[black];
+	const u64 *pieces = _pieces[C];
+	for (u64 b = pieces[KindPawn]; b; b &= b - 1) {
+		attacksPcp<C>(PawnAttacks[C][LowestBitU64(b)],pres,cov,prot);
 	}
-	if (HasSquareBelow(ks)) {
-		s = SquareBelow(ks);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
+	for (u64 b = pieces[KindRook] | pieces[KindQueen]; b; b &= b - 1) {
+		attacksPcp<C>(RookAttacks(LowestBitU64(b),occ),pres,cov,prot);
 	}
-	if (HasSquareBelowLeft(ks)) {
-		s = SquareBelowLeft(ks);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
+	for (u64 b = pieces[KindKnight]; b; b &= b - 1) {
+		attacksPcp<C>(KnightAttacks[LowestBitU64(b)],pres,cov,prot);
 	}
-	if (HasSquareLeft(ks)) {
-		s = SquareLeft(ks);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
-	if (HasSquareAboveLeft(ks)) {
-		s = SquareAboveLeft(ks);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
+	for (u64 b = pieces[KindBishop] | pieces[KindQueen]; b; b &= b - 1) {
+		attacksPcp<C>(BishopAttacks(LowestBitU64(b),occ),pres,cov,prot);
 	}
+	attacksPcp<C>(KingAttacks[LowestBitU64(pieces[KindKing])],pres,cov,prot);
 }
-void Position::knightPcp(color c, square ns, int *pres, int *cov, int *prot) const {
-	color oc = OppositeColor(c);
-	square s;
-	color sc;
-	if (HasSquareUUR(ns)) {
-		s = SquareUUR(ns);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
-	if (HasSquareUUL(ns)) {
-		s = SquareUUL(ns);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
-	if (HasSquareDDR(ns)) {
-		s = SquareDDR(ns);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
-	if (HasSquareDDL(ns)) {
-		s = SquareDDL(ns);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
-	if (HasSquareRRU(ns)) {
-		s = SquareRRU(ns);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
-	if (HasSquareRRD(ns)) {
-		s = SquareRRD(ns);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
-	if (HasSquareLLU(ns)) {
-		s = SquareLLU(ns);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
-	if (HasSquareLLD(ns)) {
-		s = SquareLLD(ns);
-		sc = squareColor(s);
-		if (sc == oc) {
-			(*pres)++;
-		} else if (sc == c) {
-			(*prot)++;
-		} else {
-			(*cov)++;
-		}
-	}
+// Attacked squares holding the opponent's pieces add pressure, our own add
+// protection and empty ones add coverage
+template<color C> void Position::attacksPcp(u64 att, int *pres, int *cov, int *prot) const {
+	*pres += CountBitsU64(att & _boardmasks[C == white ? black : white]);
+	*prot += CountBitsU64(att & _boardmasks[C]);
+	*cov += CountBitsU64(att & ~(_boardmasks[white] | _boardmasks[black]));
 }
 ostream& operator<<(ostream &out,const Position &pos) {
 	out << "     a   b   c   d   e   f   g   h\n" << "    -------------------------------\n";
@@ -14,29 +14,76 @@
 
 using namespace std;
 
+//
+// castling
+//
+// A set bit means the right to castle on that side has been lost
+//
+#define WhiteCanCastleKingsideMask 0x01
+#define WhiteCanCastleQueensideMask 0x02
+#define BlackCanCastleKingsideMask 0x04
+#define BlackCanCastleQueensideMask 0x08
+
 //
 // Position
 //
 class Position {
 public:
+	// Everything needed to take back a move made with makeMove or makeCastle
+	struct Undo {
+		piece moved;
+		square from; // Entry of _positions before the move
+		piece captured; // nopiece if nothing was taken
+		piece castledRook; // nopiece unless castling
+		square castledFrom;
+		u32 promotions;
+		u8 castling;
+		u64 key;
+	};
 	static Position initialPosition();
+	// Forsyth-Edwards Notation. En passant squares are ignored, and written
+	// positions are given move number 1. Throws unless each side has one king
+	// and the side not to move is not in check.
+	static Position fromFEN(const string&, color *turn, int *halfmoves);
+	string toFEN(color turn, int halfmoves) const;
 	// + Favors white
 	// - Favors black
 	int value() const;
 	color squareColor(square) const;
+	u64 boardmask(color) const;
 	bool squareEmpty(square) const;
 	piece pieceForSquareAndColor(square,color) const;
 	square squareForPiece(piece) const;
 	int numForColor(color) const;
 	int numForColorInFile(color,char file) const;
 	int numForPieceChar(char,color) const;
+	u64 piecesOfKind(int kind, color) const; // Promoted pawns count as their new kind
 	char promotionCharForPromotedPawn(piece p) const;
 	bool inCheck(color) const;
+	u64 attackersTo(square, color by) const;
+	u64 attackersTo(square, color by, u64 occ) const;
+	u64 checkers(color) const;
+	u64 pinned(color) const;
+	bool squareAttacked(square, color by, u64 occ) const;
 	void movePiece(piece p, square to);
 	void takePiece(piece p, square to);
 	void promotePawn(piece p, char);
+	// Target square may carry TakesMask. Promotion char is 0 if none.
+	void makeMove(piece p, square to, char promotion, Undo*);
+	void makeCastle(color, u8 side, Undo*); // smCastleKingside or smCastleQueenside
+	void unmakeMove(const Undo&);
+	// Legal moves for the side to move. En passant is not generated.
+	void legalMoves(color, MoveList*) const;
+	void makeMove(PackedMove, Undo*);
+	// Notation for a legal move, with the origin square given in full
+	Move moveForPacked(PackedMove) const;
+	// Number of legal moves the notation describes, the first of them in match
+	int movesMatching(const Move&, const MoveList&, PackedMove *match) const;
 	bool operator==(const Position&) const;
-	Move moveToPositionForColor(const Position&,color) const;
+	// Zobrist key of the pieces, castling rights and side to move. Making a
+	// move switches the side to move.
+	u64 key() const;
+	u64 computeKey() const; // From scratch, for checking the incremental key
 	static square squareForBoardmask(u64);
 	static string stringForFileLabels();
 	static string stringForTopBorder();
@@ -47,15 +94,25 @@ public:
 	void pcp(int *pres, int *cov, int *prot) const;
 	void pcpFor(color,int *pres, int *cov, int *prot) const;
 private:
-	// Pressure, coverage, protection
-	void rookPcp(color,square rs,int *pres, int *cov, int *prot) const;
-	void bishopPcp(color,square rs,int *pres, int *cov, int *prot) const;
-	void knightPcp(color c, square ns, int *pres, int *cov, int *prot) const;
-	void kingPcp(color c, square ks, int *pres, int *cov, int *prot) const;
+	void placePiece(char pc, color, square);
+	template<color C> void generateMoves(MoveList*) const;
+	static void addMoves(square from, u64 targets, u64 theirs, MoveList*);
+	static u64 allowedFor(square, square ks, u64 evasions, u64 pinned);
+	u64 pieceKey(piece) const;
+	int pieceKind(piece) const;
+	void setPieceMasks();
+	// Pressure, coverage, protection, specialized on the color
+	template<color C> void pcpFor(int *pres, int *cov, int *prot) const;
+	template<color C> void attacksPcp(u64 attacks,int *pres, int *cov, int *prot) const;
 	square _positions[32];
+	piece _board[64]; // Piece on each square, nopiece if empty
 	u64 _boardmasks[2];
+	u64 _pieces[2][NumKinds]; // Squares of each kind of piece
 	u32 _promotions;
+	u8 _castling;
+	u64 _key;
 	friend class Node;
+	friend class AlphaBeta;
 };
 ostream& operator<<(ostream&,const Position&);
 
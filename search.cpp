@@ -0,0 +1,265 @@
+//
+// search.cpp
+//
+
+#include "search.h"
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "config.h"
+#include "tt.h"
+
+using namespace std;
+using namespace std::chrono;
+
+#define SearchInfinity (2*WhiteMate)
+#define MateBound (WhiteMate - 2*MaxSearchDepth) // Values beyond are mates
+#define MatingValue (MateBound - 8) // Mating sequences, below every mate
+
+// Position::value scores the king and queen or rook against king endings from
+// WhiteMate up, by how near the lone king is to a corner. Those are kept
+// below MateBound here, so that mates found rank higher and are not confused
+// with them.
+static int StaticValue(const Position &p) {
+	int value = p.value();
+	if (value >= WhiteMate) return MatingValue + value - WhiteMate;
+	if (value <= BlackMate) return -MatingValue + value - BlackMate;
+	return value;
+}
+
+// Mates are stored as distances from the position rather than from the root,
+// and values as favoring white, so that the entry holds wherever it is found
+static int ValueToTT(int value, int ply, color c) {
+	if (value >= MateBound) value += ply;
+	else if (value <= -MateBound) value -= ply;
+	return c == white ? value : -value;
+}
+static int ValueFromTT(int value, int ply, color c) {
+	if (c == black) value = -value;
+	if (value >= MateBound) value -= ply;
+	else if (value <= -MateBound) value += ply;
+	return value;
+}
+
+AlphaBeta::AlphaBeta(const Position &p, color turn, int movesWithoutPawnMove) :
+		_pos(p), _turn(turn), _movesWithoutPawnMove(movesWithoutPawnMove),
+		_nodes(0), _maxnodes(0), _stopped(false), _stop(0), _best(NoMove), _rootBest(NoMove),
+		_value(0), _depth(0), _seconds(0) { }
+PackedMove AlphaBeta::search(int maxdepth, size_t maxnodes, ostream *report, int firstdepth) {
+	steady_clock::time_point start = steady_clock::now();
+	_nodes = 0;
+	_maxnodes = maxnodes;
+	_stopped = false;
+	_depth = 0;
+	MoveList moves;
+	_pos.legalMoves(_turn,&moves);
+	if (moves.size == 0) return _best = NoMove;
+	_best = moves[0];
+	_value = StaticValue(_pos);
+	int prev = 0;
+	for (int d = firstdepth; d <= maxdepth; d++) {
+		// Search a window around the previous value, widening it on the side
+		// the value fell out of
+		int window = AspirationWindow;
+		int alpha = d > firstdepth ? prev - window : -SearchInfinity;
+		int beta = d > firstdepth ? prev + window : SearchInfinity;
+		int val;
+		while (1) {
+			if (_turn == white) {
+				val = pvs<white>(d,0,alpha,beta,_movesWithoutPawnMove);
+			} else {
+				val = pvs<black>(d,0,alpha,beta,_movesWithoutPawnMove);
+			}
+			if (_stopped) break;
+			if (val <= alpha && alpha > -SearchInfinity) {
+				window *= 2;
+				alpha = val - window < -SearchInfinity ? -SearchInfinity : val - window;
+			} else if (val >= beta && beta < SearchInfinity) {
+				window *= 2;
+				beta = val + window > SearchInfinity ? SearchInfinity : val + window;
+			} else {
+				break;
+			}
+		}
+		if (_stopped) break;
+		prev = val;
+		_best = _rootBest;
+		_value = _turn == white ? val : -val;
+		_depth = d;
+		if (report) {
+			double secs = duration<double>(steady_clock::now() - start).count();
+			*report << "depth " << d << ": " << _pos.moveForPacked(_best) << " value " << _value
+				<< ", " << _nodes << " nodes, " << (secs > 0 ? _nodes/secs : 0) << " nodes/s\n";
+		}
+		if (val >= MateBound || val <= -MateBound) break;
+	}
+	_seconds = duration<double>(steady_clock::now() - start).count();
+	return _best;
+}
+void AlphaBeta::stopWhen(const atomic<bool> *stop) { _stop = stop; }
+int AlphaBeta::value() const { return _value; }
+int AlphaBeta::depth() const { return _depth; }
+size_t AlphaBeta::nodes() const { return _nodes; }
+double AlphaBeta::seconds() const { return _seconds; }
+bool AlphaBeta::outOfNodes() {
+	if (++_nodes >= _maxnodes || (_stop && _stop->load(memory_order_relaxed))) _stopped = true;
+	return _stopped;
+}
+// Values are for the side to move, C. The first move is searched with the
+// full window and the others with a null window, searched again only if they
+// turn out better.
+template<color C> int AlphaBeta::pvs(int depth, int ply, int alpha, int beta, int movesWithoutPawnMove) {
+	const color oc = C == white ? black : white;
+	if (depth <= 0) return quiesce<C>(ply,alpha,beta);
+	if (outOfNodes()) return 0;
+	if (movesWithoutPawnMove >= MaxMovesWithoutPawnMove) return Stalemate;
+	TTEntry e;
+	u16 ttmove = 0;
+	if (TT && TT->probe(_pos.key(),&e)) {
+		ttmove = e.move;
+		if (ply > 0 && e.depth >= depth) {
+			int val = ValueFromTT(e.value,ply,C);
+			if (e.bound == BoundExact ||
+				(e.bound == BoundLower && val >= beta) ||
+				(e.bound == BoundUpper && val <= alpha)) {
+				return val;
+			}
+		}
+	}
+	MoveList moves;
+	_pos.legalMoves(C,&moves);
+	if (moves.size == 0) {
+		return _pos.inCheck(C) ? -(WhiteMate - ply) : Stalemate;
+	}
+	int scores[MaxMoves];
+	scoreMoves<C>(moves,ttmove,scores);
+	int alpha0 = alpha, best = -SearchInfinity;
+	PackedMove bestmove = moves[0];
+	for (int i = 0; i < moves.size; i++) {
+		PackedMove m = nextMove(&moves,scores,i);
+		int next = _pos._pieces[C][KindPawn] & ((u64)1 << m.from()) ? 0 : movesWithoutPawnMove + 1;
+		Position::Undo undo;
+		_pos.makeMove(m,&undo);
+		int val;
+		if (i == 0) {
+			val = -pvs<oc>(depth-1,ply+1,-beta,-alpha,next);
+		} else {
+			val = -pvs<oc>(depth-1,ply+1,-alpha-1,-alpha,next);
+			if (val > alpha && val < beta) val = -pvs<oc>(depth-1,ply+1,-beta,-alpha,next);
+		}
+		_pos.unmakeMove(undo);
+		if (_stopped) return 0;
+		if (val > best) {
+			best = val;
+			bestmove = m;
+			if (val > alpha) alpha = val;
+			if (alpha >= beta) break;
+		}
+	}
+	if (ply == 0) _rootBest = bestmove;
+	if (TT) {
+		e.value = ValueToTT(best,ply,C);
+		e.depth = depth;
+		e.bound = best <= alpha0 ? BoundUpper : best >= beta ? BoundLower : BoundExact;
+		e.move = TTMove(bestmove.from(),bestmove.to());
+		TT->store(_pos.key(),e);
+	}
+	return best;
+}
+// Captures and promotions only, until the position is quiet. The side to
+// move may always stand pat instead.
+template<color C> int AlphaBeta::quiesce(int ply, int alpha, int beta) {
+	const color oc = C == white ? black : white;
+	if (outOfNodes()) return 0;
+	MoveList moves;
+	_pos.legalMoves(C,&moves);
+	if (moves.size == 0) {
+		return _pos.inCheck(C) ? -(WhiteMate - ply) : Stalemate;
+	}
+	int best = C == white ? StaticValue(_pos) : -StaticValue(_pos);
+	if (best >= beta || ply >= 2*MaxSearchDepth) return best;
+	if (best > alpha) alpha = best;
+	int scores[MaxMoves];
+	scoreMoves<C>(moves,0,scores);
+	for (int i = 0; i < moves.size; i++) {
+		PackedMove m = nextMove(&moves,scores,i);
+		if (!m.takes() && !m.promotion()) break; // Sorted after all captures
+		Position::Undo undo;
+		_pos.makeMove(m,&undo);
+		int val = -quiesce<oc>(ply+1,-beta,-alpha);
+		_pos.unmakeMove(undo);
+		if (_stopped) return 0;
+		if (val > best) {
+			best = val;
+			if (val > alpha) alpha = val;
+			if (alpha >= beta) break;
+		}
+	}
+	return best;
+}
+// The table move first, then captures of the most valuable pieces by the
+// least valuable ones, then promotions, then the rest
+template<color C> void AlphaBeta::scoreMoves(const MoveList &moves, u16 ttmove, int *scores) const {
+	static const int values[NumKinds] = { PawnWeight, RookWeight, KnightWeight, BishopWeight, QueenWeight, 0 };
+	for (int i = 0; i < moves.size; i++) {
+		PackedMove m = moves[i];
+		int score = 0;
+		if (ttmove && TTMove(m.from(),m.to()) == ttmove) {
+			score = 1 << 20;
+		} else if (m.takes()) {
+			int victim = values[_pos.pieceKind(_pos._board[m.to()])];
+			int attacker = values[_pos.pieceKind(_pos._board[m.from()])];
+			score = (1 << 16) + 16*victim - attacker;
+		} else if (m.promotion()) {
+			score = 1 << 15;
+		}
+		if (m.promotion()) score += IdxForPromotionChar(m.promotionChar());
+		scores[i] = score;
+	}
+}
+// Swaps the best scored of the remaining moves into place i
+PackedMove AlphaBeta::nextMove(MoveList *moves, int *scores, int i) {
+	int best = i;
+	for (int j = i + 1; j < moves->size; j++) {
+		if (scores[j] > scores[best]) best = j;
+	}
+	PackedMove m = moves->moves[best];
+	moves->moves[best] = moves->moves[i];
+	moves->moves[i] = m;
+	int s = scores[best];
+	scores[best] = scores[i];
+	scores[i] = s;
+	return m;
+}
+
+//
+// LazySMP
+//
+LazySMP::LazySMP(const Position &p, color turn, int movesWithoutPawnMove, int threads) :
+		_searches(threads < 1 ? 1 : threads, AlphaBeta(p,turn,movesWithoutPawnMove)) { }
+PackedMove LazySMP::search(int maxdepth, size_t maxnodes, ostream *report) {
+	atomic<bool> stop(false);
+	vector<thread> helpers;
+	for (size_t t = 1; t < _searches.size(); t++) {
+		_searches[t].stopWhen(&stop);
+		helpers.push_back(thread([this,t,maxdepth]() {
+			_searches[t].search(maxdepth,SIZE_MAX,0,1 + t%2);
+		}));
+	}
+	PackedMove best = _searches[0].search(maxdepth,maxnodes,report);
+	stop = true;
+	for (size_t t = 0; t < helpers.size(); t++) helpers[t].join();
+	return best;
+}
+int LazySMP::value() const { return _searches[0].value(); }
+int LazySMP::depth() const { return _searches[0].depth(); }
+size_t LazySMP::nodes() const {
+	size_t nodes = 0;
+	for (size_t t = 0; t < _searches.size(); t++) nodes += _searches[t].nodes();
+	return nodes;
+}
+size_t LazySMP::nodes(int thread) const { return _searches[thread].nodes(); }
+double LazySMP::seconds() const { return _searches[0].seconds(); }
+int LazySMP::threads() const { return _searches.size(); }
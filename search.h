@@ -0,0 +1,90 @@
+//
+// search.h
+// Alpha-beta search
+//
+
+#ifndef search_h
+#define search_h
+
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+#include "board.h"
+#include "move.h"
+#include "position.h"
+
+using namespace std;
+
+//
+// search mode
+//
+#define SearchTree 0 // Best-first growth of the Node tree
+#define SearchAlphaBeta 1
+#define SearchMCTS 2 // Monte-Carlo tree search over the Node tree
+
+//
+// AlphaBeta
+//
+// Principal variation search from a position, deepened one ply at a time
+// with an aspiration window around the previous iteration's value. Results
+// are shared through the transposition table, if there is one.
+//
+class AlphaBeta {
+public:
+	AlphaBeta(const Position&, color turn, int movesWithoutPawnMove);
+	// Searches until maxdepth plies or maxnodes nodes, whichever comes first,
+	// and returns the best move of the deepest completed iteration. NoMove if
+	// there are no legal moves. Report, if given, gets a line per iteration.
+	// Iterations start at firstdepth plies.
+	PackedMove search(int maxdepth, size_t maxnodes, ostream *report = 0, int firstdepth = 1);
+	// Also stops the search once stop is set, as if out of nodes
+	void stopWhen(const atomic<bool> *stop);
+	int value() const; // + Favors white
+	int depth() const; // Plies of the deepest completed iteration
+	size_t nodes() const;
+	double seconds() const;
+private:
+	template<color C> int pvs(int depth, int ply, int alpha, int beta, int movesWithoutPawnMove);
+	template<color C> int quiesce(int ply, int alpha, int beta);
+	template<color C> void scoreMoves(const MoveList&, u16 ttmove, int *scores) const;
+	static PackedMove nextMove(MoveList*, int *scores, int i);
+	bool outOfNodes();
+	Position _pos;
+	color _turn;
+	int _movesWithoutPawnMove;
+	size_t _nodes;
+	size_t _maxnodes;
+	bool _stopped;
+	const atomic<bool> *_stop;
+	PackedMove _best;
+	PackedMove _rootBest; // Of the iteration in progress
+	int _value;
+	int _depth;
+	double _seconds;
+};
+
+//
+// LazySMP
+//
+// Searches a position on several threads at once, sharing the transposition
+// table. The main thread searches as AlphaBeta alone would, and its result is
+// the one played. The helpers search the same position with every other one
+// starting a ply deeper, filling the table ahead of the main thread, until it
+// is done.
+//
+class LazySMP {
+public:
+	LazySMP(const Position&, color turn, int movesWithoutPawnMove, int threads);
+	PackedMove search(int maxdepth, size_t maxnodes, ostream *report = 0);
+	int value() const;
+	int depth() const;
+	size_t nodes() const; // Of all threads
+	size_t nodes(int thread) const; // The main thread is 0
+	double seconds() const;
+	int threads() const;
+private:
+	vector<AlphaBeta> _searches;
+};
+
+#endif // search_h
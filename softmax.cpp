@@ -0,0 +1,159 @@
+//
+// softmax.cpp
+//
+
+#include "softmax.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HardwareSoftmax
+#define TargetSSE2 __attribute__((target("sse2")))
+#define TargetAVX2 __attribute__((target("avx2,fma")))
+#endif
+
+using namespace std;
+
+void (*Softmax)(float*, int) = SoftmaxScalar;
+
+void SoftmaxScalar(float *weights, int num) {
+	float sum = 0;
+	for (int i = 0; i < num; i++) {
+		weights[i] = expf(weights[i]);
+		sum += weights[i];
+	}
+	for (int i = 0; i < num; i++) {
+		weights[i] /= sum;
+	}
+}
+
+#ifdef HardwareSoftmax
+// exp(x) = 2^n * exp(f), with n the nearest integer to x/ln 2 and f the
+// remainder, split over two constants to keep its precision. exp(f) is the
+// Cephes polynomial. Arguments are clamped to the range of normal floats.
+#define ExpMin -87.0f
+#define ExpMax 88.0f
+#define ExpLog2e 1.44269504088896341f
+#define ExpLn2Hi 0.693359375f
+#define ExpLn2Lo -2.12194440e-4f
+#define ExpP0 1.9875691500e-4f
+#define ExpP1 1.3981999507e-3f
+#define ExpP2 8.3334519073e-3f
+#define ExpP3 4.1665795894e-2f
+#define ExpP4 1.6666665459e-1f
+#define ExpP5 5.0000001201e-1f
+TargetSSE2 static inline __m128 Exp128(__m128 x) {
+	x = _mm_min_ps(_mm_max_ps(x,_mm_set1_ps(ExpMin)),_mm_set1_ps(ExpMax));
+	__m128i n = _mm_cvtps_epi32(_mm_mul_ps(x,_mm_set1_ps(ExpLog2e)));
+	__m128 nf = _mm_cvtepi32_ps(n);
+	__m128 f = _mm_sub_ps(x,_mm_mul_ps(nf,_mm_set1_ps(ExpLn2Hi)));
+	f = _mm_sub_ps(f,_mm_mul_ps(nf,_mm_set1_ps(ExpLn2Lo)));
+	__m128 p = _mm_set1_ps(ExpP0);
+	p = _mm_add_ps(_mm_mul_ps(p,f),_mm_set1_ps(ExpP1));
+	p = _mm_add_ps(_mm_mul_ps(p,f),_mm_set1_ps(ExpP2));
+	p = _mm_add_ps(_mm_mul_ps(p,f),_mm_set1_ps(ExpP3));
+	p = _mm_add_ps(_mm_mul_ps(p,f),_mm_set1_ps(ExpP4));
+	p = _mm_add_ps(_mm_mul_ps(p,f),_mm_set1_ps(ExpP5));
+	p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p,f),f),f),_mm_set1_ps(1));
+	__m128i e = _mm_slli_epi32(_mm_add_epi32(n,_mm_set1_epi32(127)),23);
+	return _mm_mul_ps(p,_mm_castsi128_ps(e));
+}
+TargetAVX2 static inline __m256 Exp256(__m256 x) {
+	x = _mm256_min_ps(_mm256_max_ps(x,_mm256_set1_ps(ExpMin)),_mm256_set1_ps(ExpMax));
+	__m256 nf = _mm256_round_ps(_mm256_mul_ps(x,_mm256_set1_ps(ExpLog2e)),_MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC);
+	__m256 f = _mm256_fnmadd_ps(nf,_mm256_set1_ps(ExpLn2Hi),x);
+	f = _mm256_fnmadd_ps(nf,_mm256_set1_ps(ExpLn2Lo),f);
+	__m256 p = _mm256_set1_ps(ExpP0);
+	p = _mm256_fmadd_ps(p,f,_mm256_set1_ps(ExpP1));
+	p = _mm256_fmadd_ps(p,f,_mm256_set1_ps(ExpP2));
+	p = _mm256_fmadd_ps(p,f,_mm256_set1_ps(ExpP3));
+	p = _mm256_fmadd_ps(p,f,_mm256_set1_ps(ExpP4));
+	p = _mm256_fmadd_ps(p,f,_mm256_set1_ps(ExpP5));
+	p = _mm256_add_ps(_mm256_fmadd_ps(_mm256_mul_ps(p,f),f,f),_mm256_set1_ps(1));
+	__m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(nf),_mm256_set1_epi32(127)),23);
+	return _mm256_mul_ps(p,_mm256_castsi256_ps(e));
+}
+// The values left over after the last full vector are copied into a padded
+// one, and only their weights are kept
+TargetSSE2 void SoftmaxSSE2(float *weights, int num) {
+	__m128 sum = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 4 <= num; i += 4) {
+		__m128 w = Exp128(_mm_loadu_ps(weights+i));
+		_mm_storeu_ps(weights+i,w);
+		sum = _mm_add_ps(sum,w);
+	}
+	float total = 0;
+	if (i < num) {
+		float w[4] = {};
+		for (int j = i; j < num; j++) w[j-i] = weights[j];
+		_mm_storeu_ps(w,Exp128(_mm_loadu_ps(w)));
+		for (int j = i; j < num; j++) {
+			weights[j] = w[j-i];
+			total += w[j-i];
+		}
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes,sum);
+	total += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	__m128 inv = _mm_set1_ps(1/total);
+	for (i = 0; i + 4 <= num; i += 4) {
+		_mm_storeu_ps(weights+i,_mm_mul_ps(_mm_loadu_ps(weights+i),inv));
+	}
+	for (; i < num; i++) weights[i] /= total;
+}
+TargetAVX2 void SoftmaxAVX2(float *weights, int num) {
+	__m256 sum = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= num; i += 8) {
+		__m256 w = Exp256(_mm256_loadu_ps(weights+i));
+		_mm256_storeu_ps(weights+i,w);
+		sum = _mm256_add_ps(sum,w);
+	}
+	float total = 0;
+	if (i < num) {
+		float w[8] = {};
+		for (int j = i; j < num; j++) w[j-i] = weights[j];
+		_mm256_storeu_ps(w,Exp256(_mm256_loadu_ps(w)));
+		for (int j = i; j < num; j++) {
+			weights[j] = w[j-i];
+			total += w[j-i];
+		}
+	}
+	float lanes[8];
+	_mm256_storeu_ps(lanes,sum);
+	for (int j = 0; j < 8; j++) total += lanes[j];
+	__m256 inv = _mm256_set1_ps(1/total);
+	for (i = 0; i + 8 <= num; i += 8) {
+		_mm256_storeu_ps(weights+i,_mm256_mul_ps(_mm256_loadu_ps(weights+i),inv));
+	}
+	for (; i < num; i++) weights[i] /= total;
+}
+#else
+void SoftmaxSSE2(float *weights, int num) {
+	SoftmaxScalar(weights,num);
+}
+void SoftmaxAVX2(float *weights, int num) {
+	SoftmaxScalar(weights,num);
+}
+#endif
+
+bool CpuHasSSE2() {
+#ifdef HardwareSoftmax
+	return __builtin_cpu_supports("sse2");
+#else
+	return false;
+#endif
+}
+bool CpuHasAVX2() {
+#ifdef HardwareSoftmax
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	return false;
+#endif
+}
+void InitSoftmax() {
+	if (CpuHasSSE2()) Softmax = SoftmaxSSE2;
+	if (CpuHasAVX2()) Softmax = SoftmaxAVX2;
+}
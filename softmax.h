@@ -0,0 +1,27 @@
+//
+// softmax.h
+// Prediction weights
+//
+
+#ifndef softmax_h
+#define softmax_h
+
+#include "board.h"
+
+//
+// softmax
+//
+// Replaces num values x with the weights exp(x), normalized to sum to 1. The
+// scalar version calls expf; the SSE2 and AVX2 versions evaluate four or
+// eight at a time with a polynomial that stays within 1e-6 of expf relative
+// to it. InitSoftmax points Softmax at the widest version the CPU supports.
+//
+extern void (*Softmax)(float *weights, int num);
+void SoftmaxScalar(float*, int);
+void SoftmaxSSE2(float*, int);
+void SoftmaxAVX2(float*, int);
+bool CpuHasSSE2();
+bool CpuHasAVX2();
+void InitSoftmax();
+
+#endif // softmax_h
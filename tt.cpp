@@ -0,0 +1,102 @@
+//
+// tt.cpp
+//
+
+#include "tt.h"
+
+#include <climits>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+using namespace std;
+
+TranspositionTable *TT = 0;
+
+//
+// TranspositionTable
+//
+TranspositionTable::TranspositionTable(size_t megabytes) :
+		_buckets(0), _mask(0), _generation(0), _counting(false), _probes(0), _hits(0) {
+	size_t num = 1;
+	while (2*num*sizeof(Bucket) <= megabytes << 20) num *= 2;
+	// Plain new need not align the buckets to cache lines before C++17
+	void *mem;
+	if (posix_memalign(&mem,alignof(Bucket),num*sizeof(Bucket)) != 0) {
+		throw runtime_error("failed to allocate transposition table");
+	}
+	_buckets = (Bucket*)mem;
+	for (size_t i = 0; i < num; i++) new (&_buckets[i]) Bucket();
+	_mask = num - 1;
+}
+TranspositionTable::~TranspositionTable() {
+	free(_buckets);
+}
+// Data layout, from the low bits: value (32), depth (8), bound (2),
+// generation (6), move (16)
+u64 TranspositionTable::pack(const TTEntry &e, u8 generation) {
+	return (u64)(u32)e.value | (u64)(e.depth & 0xff) << 32 | (u64)(e.bound & 3) << 40 |
+		(u64)(generation & 0x3f) << 42 | (u64)e.move << 48;
+}
+void TranspositionTable::unpack(u64 data, TTEntry *e) {
+	e->value = (int)(u32)data;
+	e->depth = (data >> 32) & 0xff;
+	e->bound = (data >> 40) & 3;
+	e->move = data >> 48;
+}
+bool TranspositionTable::probe(u64 key, TTEntry *e) {
+	if (_counting) _probes.fetch_add(1,memory_order_relaxed);
+	Bucket &b = _buckets[key & _mask];
+	for (int i = 0; i < TTBucketSlots; i++) {
+		u64 data = b.slots[i].data.load(memory_order_relaxed);
+		u64 check = b.slots[i].check.load(memory_order_relaxed);
+		if ((check ^ data) == key && ((data >> 40) & 3) != BoundNone) {
+			unpack(data,e);
+			if (_counting) _hits.fetch_add(1,memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+void TranspositionTable::store(u64 key, const TTEntry &e) {
+	Bucket &b = _buckets[key & _mask];
+	// Take the slot with the same key, or else the one from the oldest search
+	// with the shallowest depth
+	int replace = 0, worst = INT_MAX;
+	for (int i = 0; i < TTBucketSlots; i++) {
+		u64 data = b.slots[i].data.load(memory_order_relaxed);
+		u64 check = b.slots[i].check.load(memory_order_relaxed);
+		if ((check ^ data) == key) {
+			// Keep a deeper result for the same position from this search
+			if (((data >> 32) & 0xff) > (u64)e.depth && ((data >> 42) & 0x3f) == _generation) return;
+			replace = i;
+			break;
+		}
+		int age = (_generation - (data >> 42)) & 0x3f;
+		int score = (int)((data >> 32) & 0xff) - 8*age;
+		if (((data >> 40) & 3) == BoundNone) score = INT_MIN;
+		if (score < worst) {
+			worst = score;
+			replace = i;
+		}
+	}
+	u64 data = pack(e,_generation);
+	b.slots[replace].check.store(key ^ data,memory_order_relaxed);
+	b.slots[replace].data.store(data,memory_order_relaxed);
+}
+void TranspositionTable::newSearch() {
+	_generation = (_generation + 1) & 0x3f;
+}
+void TranspositionTable::clear() {
+	for (size_t i = 0; i <= _mask; i++) {
+		for (int j = 0; j < TTBucketSlots; j++) {
+			_buckets[i].slots[j].check.store(0,memory_order_relaxed);
+			_buckets[i].slots[j].data.store(0,memory_order_relaxed);
+		}
+	}
+	_probes = 0;
+	_hits = 0;
+}
+void TranspositionTable::countProbes(bool counting) { _counting = counting; }
+size_t TranspositionTable::probes() const { return _probes; }
+size_t TranspositionTable::hits() const { return _hits; }
@@ -0,0 +1,80 @@
+//
+// tt.h
+// Transposition table
+//
+
+#ifndef tt_h
+#define tt_h
+
+#include <atomic>
+
+#include "board.h"
+
+using namespace std;
+
+//
+// bound type
+//
+#define BoundNone 0
+#define BoundExact 1
+#define BoundLower 2 // Value is at least the stored one
+#define BoundUpper 3 // Value is at most the stored one
+
+//
+// table move
+//
+// Origin and destination squares of the best move, 0 if there is none
+//
+inline u16 TTMove(square from, square to) { return (u16)((from << 6) | to | 0x1000); }
+inline square TTMoveFrom(u16 m) { return (m >> 6) & 0x3f; }
+inline square TTMoveTo(u16 m) { return m & 0x3f; }
+
+struct TTEntry {
+	int value;
+	int depth; // Plies searched below the position
+	int bound;
+	u16 move;
+};
+
+//
+// TranspositionTable
+//
+// Fixed-size table of search results keyed by Position::key. Entries live in
+// cache-line sized and aligned buckets and are written without locks: each
+// slot holds its key XORed with its data, so a slot torn by a concurrent store
+// fails to match and reads as a miss. Probes and hits are counted only once
+// countProbes is set, since the counters are shared by every thread.
+//
+class TranspositionTable {
+public:
+	TranspositionTable(size_t megabytes);
+	~TranspositionTable();
+	bool probe(u64 key, TTEntry*);
+	void store(u64 key, const TTEntry&);
+	void newSearch(); // Ages the entries from earlier searches
+	void clear();
+	void countProbes(bool);
+	size_t probes() const;
+	size_t hits() const;
+private:
+	struct Slot {
+		atomic<u64> check; // key ^ data
+		atomic<u64> data;
+	};
+#define TTBucketSlots 4
+	struct alignas(64) Bucket {
+		Slot slots[TTBucketSlots];
+	};
+	static u64 pack(const TTEntry&, u8 generation);
+	static void unpack(u64, TTEntry*);
+	Bucket *_buckets;
+	size_t _mask;
+	u8 _generation;
+	bool _counting;
+	atomic_size_t _probes;
+	atomic_size_t _hits;
+};
+
+extern TranspositionTable *TT; // 0 if there is none
+
+#endif // tt_h